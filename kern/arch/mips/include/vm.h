@@ -117,14 +117,90 @@ paddr_t ram_getfirstfree(void);
  * We'll take up to 16 invalidations before just flushing the whole TLB.
  */
 
+struct addrspace;
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	struct addrspace *ts_as;	/* address space the page is in */
+	vaddr_t ts_vaddr;		/* page to invalidate */
 };
 
 #define TLBSHOOTDOWN_MAX 16
 
+/*
+ * Address space IDs (asid.c).
+ *
+ * Each CPU hands out the 63 non-zero hardware IDs to the address
+ * spaces that run on it, in generations: when it runs out, it flushes
+ * its TLB, starts a new generation, and every address space has to
+ * get a new ID there the next time it runs. An address space keeps
+ * the ID it has on each CPU, tagged with the generation, in its
+ * asid_set; 0 means it has none. ID 0 itself is never given out, so
+ * it can be used when no address space is active.
+ *
+ *    asid_activate   - make AS's ID on this CPU the current one,
+ *                      assigning a new one if needed.
+ *    asid_invalidate - drop every translation for AS on all CPUs by
+ *                      forgetting its IDs. If AS is the one active on
+ *                      this CPU, it gets a fresh ID right away.
+ *    asid_lookup     - return AS's ID on this CPU, or 0 if it has no
+ *                      current one (and so no translations here).
+ *    asid_current    - return the ID active on this CPU.
+ *    asid_cpumask    - return the CPUs on which AS has a current ID,
+ *                      one bit per cpu number. Only these can hold
+ *                      translations for it, so only these need to
+ *                      hear about shootdowns.
+ *
+ * Anything that loads the TLB's ENTRYHI register other than with the
+ * current ID (tlb_read, invalidations) must call
+ * tlb_setpid(asid_current()) before returning.
+ */
+
+#include <platform/maxcpus.h>
+
+struct asid_set {
+	uint32_t as_ids[MAXCPUS];	/* generation << 6 | ID, per CPU */
+};
+
+void asid_activate(struct addrspace *as);
+void asid_invalidate(struct addrspace *as);
+uint32_t asid_lookup(struct addrspace *as);
+uint32_t asid_current(void);
+uint32_t asid_cpumask(struct addrspace *as);
+void asid_printstats(void);
+
+/*
+ * Fast-path TLB refill (exception-mips1.S).
+ *
+ * The UTLB miss handler walks the page table of the address space
+ * active on its CPU, found in mips_utlb_ptdir, and loads resident
+ * pages into the TLB itself. Anything else (no page table, page not
+ * resident or being paged out) goes the long way round to vm_fault.
+ * The counters say how many misses each CPU handled each way.
+ *
+ *    vm_utlb_setpt - point this CPU's handler at PT, or at nothing.
+ */
+
+struct pagetable;
+
+extern void *mips_utlb_ptdir[MAXCPUS];
+extern unsigned mips_utlb_nfast[MAXCPUS];
+extern unsigned mips_utlb_nslow[MAXCPUS];
+
+void vm_utlb_setpt(struct pagetable *pt);
+void vm_utlb_printstats(void);
+
+/*
+ * Fault-around. If vm_faultaround is N > 0, a TLB miss also loads up
+ * to N neighbouring pages of the same region that are already
+ * resident: the ones in the (N+1)-page-aligned window around the
+ * missing page. This is done in vm_fault, so while it's on the fast
+ * refill path is skipped and every miss goes the long way round;
+ * whether fewer, dearer misses win depends on how sequential the
+ * program is. 0 (the default) turns it off.
+ */
+#define FAULTAROUND_MAX	16
+
+extern unsigned vm_faultaround;
+
 
 #endif /* _MIPS_VM_H_ */
@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/wait.h>
 #include <signal.h>
 #include <lib.h>
 #include <mips/specialreg.h>
@@ -117,14 +118,7 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
 	kprintf("Fatal user mode trap %u sig %d (%s, epc 0x%x, vaddr 0x%x)\n",
 		code, sig, trapcodenames[code], epc, vaddr);
 	
-	as_destroy((struct addrspace *)vaddr);
-	//proc_rmthread(curthread);
-	if(curthread->t_stack != NULL){
-		kfree(curthread->t_stack);
-	}
-	threadlistnode_cleanup(&curthread->t_listnode);
-	thread_machdep_cleanup(&curthread->t_machdep);
-	thread_exit();
+	proc_exit(_MKWAIT_SIG(sig));
 	//panic("I don't know how to handle this\n");
 }
 
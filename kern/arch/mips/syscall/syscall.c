@@ -183,6 +183,10 @@ syscall(struct trapframe *tf)
 		}
 		break;
 
+	    case SYS_fsync:
+		err = sys_fsync(tf->tf_a0);
+		break;
+
 	    case SYS_chdir:
 		err = sys_chdir((userptr_t)tf->tf_a0);
 		break;
@@ -202,6 +206,10 @@ syscall(struct trapframe *tf)
 		err = sys_fork(tf,&(pid_t)retval);
 		break;
 
+	    case SYS_vfork:
+		err = sys_vfork(tf, &retval);
+		break;
+
 	    case SYS__exit:
 		sys__exit((int )tf->tf_a0);
 		return;
@@ -218,6 +226,55 @@ syscall(struct trapframe *tf)
 		err = sys_execv((char *)tf->tf_a0,(char **)tf->tf_a1);
 		break;
 
+	    /* Memory calls */
+	    case SYS_sbrk:
+		err = sys_sbrk((intptr_t)tf->tf_a0, &retval);
+		break;
+
+	    case SYS_mmap:
+		{
+			/*
+			 * The fd and the 64-bit offset don't fit in the
+			 * argument registers; they're on the stack, the
+			 * offset aligned to 8 bytes.
+			 */
+			uint64_t offset;
+			int fd;
+
+			err = copyin((userptr_t)tf->tf_sp + 16,
+				     &fd, sizeof(int));
+			if (err) {
+				break;
+			}
+			err = copyin((userptr_t)tf->tf_sp + 24,
+				     &offset, sizeof(uint64_t));
+			if (err) {
+				break;
+			}
+
+			err = sys_mmap((userptr_t)tf->tf_a0, tf->tf_a1,
+				       tf->tf_a2, tf->tf_a3, fd, offset,
+				       &retval);
+		}
+		break;
+
+	    case SYS_munmap:
+		err = sys_munmap((userptr_t)tf->tf_a0, tf->tf_a1);
+		break;
+
+	    case SYS_madvise:
+		err = sys_madvise((userptr_t)tf->tf_a0, tf->tf_a1, tf->tf_a2);
+		break;
+
+	    case SYS_mincore:
+		err = sys_mincore((userptr_t)tf->tf_a0, tf->tf_a1,
+				  (userptr_t)tf->tf_a2);
+		break;
+
+	    case SYS___vmstat:
+		err = sys___vmstat((userptr_t)tf->tf_a0, tf->tf_a1, &retval);
+		break;
+
 	    default:
 		kprintf("Unknown syscall %d\n", callno);
 		err = ENOSYS;
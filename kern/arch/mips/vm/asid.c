@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * MIPS address space IDs. See the comment in <machine/vm.h>.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+
+#define ASID_ID(v)		((v) & (NUM_ASID - 1))
+#define ASID_GEN(v)		((v) >> TLBHI_PIDSHIFT)
+#define ASID_MAKE(gen, id)	(((gen) << TLBHI_PIDSHIFT) | (id))
+
+/*
+ * Per-CPU allocator state. Each CPU only touches its own entry, with
+ * interrupts off, so no locking is needed.
+ */
+struct asid_cpu {
+	uint32_t ac_generation;		/* current generation */
+	uint32_t ac_next;		/* next ID to hand out */
+	uint32_t ac_current;		/* ID in use now */
+	unsigned ac_assigned;		/* IDs handed out, for stats */
+	unsigned ac_rollovers;		/* generations used up */
+};
+
+static struct asid_cpu asid_cpus[MAXCPUS];
+
+/*
+ * Invalidate every entry in this CPU's TLB.
+ */
+static
+void
+asid_tlbflush(void)
+{
+	int i;
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+}
+
+/*
+ * Invalidate this CPU's TLB entries tagged with ID.
+ */
+static
+void
+asid_tlbpurge(uint32_t id)
+{
+	uint32_t ehi, elo;
+	int i;
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_read(&ehi, &elo, i);
+		if ((ehi & TLBHI_PID) >> TLBHI_PIDSHIFT == id) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+	}
+}
+
+/*
+ * Hand out the next ID on this CPU, starting a new generation if
+ * they've all been used. Call with interrupts off.
+ */
+static
+uint32_t
+asid_assign(struct asid_cpu *ac)
+{
+	if (ac->ac_generation == 0 || ac->ac_next == NUM_ASID) {
+		/*
+		 * Out of IDs (or never started). Anything tagged with
+		 * an ID from the old generation has to go.
+		 */
+		if (ac->ac_generation != 0) {
+			ac->ac_rollovers++;
+		}
+		ac->ac_generation++;
+		ac->ac_next = 1;
+		asid_tlbflush();
+	}
+	ac->ac_assigned++;
+	return ASID_MAKE(ac->ac_generation, ac->ac_next++);
+}
+
+/*
+ * Return AS's ID on this CPU if it's from the current generation, and
+ * 0 if not. Call with interrupts off.
+ */
+static
+uint32_t
+asid_get(struct asid_cpu *ac, struct addrspace *as)
+{
+	uint32_t v;
+
+	v = as->as_asids.as_ids[curcpu->c_number];
+	if (v == 0 || ASID_GEN(v) != ac->ac_generation) {
+		return 0;
+	}
+	return ASID_ID(v);
+}
+
+void
+asid_activate(struct addrspace *as)
+{
+	struct asid_cpu *ac;
+	uint32_t id;
+	int spl;
+
+	spl = splhigh();
+	ac = &asid_cpus[curcpu->c_number];
+
+	id = asid_get(ac, as);
+	if (id == 0) {
+		as->as_asids.as_ids[curcpu->c_number] = asid_assign(ac);
+		id = asid_get(ac, as);
+		KASSERT(id != 0);
+	}
+	ac->ac_current = id;
+	tlb_setpid(id);
+
+	splx(spl);
+}
+
+void
+asid_invalidate(struct addrspace *as)
+{
+	struct asid_cpu *ac;
+	uint32_t id;
+	unsigned i;
+	int spl;
+
+	spl = splhigh();
+	ac = &asid_cpus[curcpu->c_number];
+
+	/*
+	 * Entries elsewhere tagged with the old IDs are orphaned; the
+	 * IDs won't be handed out again until a rollover flushes them.
+	 * Ours we can clear out now, to free up the slots.
+	 */
+	id = asid_get(ac, as);
+	for (i=0; i<MAXCPUS; i++) {
+		as->as_asids.as_ids[i] = 0;
+	}
+	if (id == 0) {
+		splx(spl);
+		return;
+	}
+	asid_tlbpurge(id);
+
+	if (id == ac->ac_current) {
+		as->as_asids.as_ids[curcpu->c_number] = asid_assign(ac);
+		ac->ac_current = asid_get(ac, as);
+	}
+	tlb_setpid(ac->ac_current);
+
+	splx(spl);
+}
+
+uint32_t
+asid_lookup(struct addrspace *as)
+{
+	uint32_t id;
+	int spl;
+
+	spl = splhigh();
+	id = asid_get(&asid_cpus[curcpu->c_number], as);
+	splx(spl);
+	return id;
+}
+
+uint32_t
+asid_current(void)
+{
+	return asid_cpus[curcpu->c_number].ac_current;
+}
+
+/*
+ * Other CPUs' generations are read without any locking. A stale
+ * answer can only add a CPU that no longer needs telling, or miss one
+ * that is just now giving AS an ID, and so has no entries for it yet.
+ */
+uint32_t
+asid_cpumask(struct addrspace *as)
+{
+	uint32_t v, mask;
+	unsigned i;
+
+	mask = 0;
+	for (i=0; i<MAXCPUS; i++) {
+		v = as->as_asids.as_ids[i];
+		if (v != 0 && ASID_GEN(v) == asid_cpus[i].ac_generation) {
+			mask |= (uint32_t)1 << i;
+		}
+	}
+	return mask;
+}
+
+void
+asid_printstats(void)
+{
+	unsigned i;
+
+	for (i=0; i<MAXCPUS; i++) {
+		if (asid_cpus[i].ac_generation == 0) {
+			continue;
+		}
+		kprintf("cpu%u: asid generation %u, %u ids assigned, "
+			"%u rollovers\n", i, asid_cpus[i].ac_generation,
+			asid_cpus[i].ac_assigned, asid_cpus[i].ac_rollovers);
+	}
+}
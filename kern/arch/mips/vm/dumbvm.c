@@ -29,6 +29,7 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
 #include <lib.h>
 #include <spl.h>
 #include <spinlock.h>
@@ -37,8 +38,13 @@
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <cpu.h>
 #include <coremap.h>
-#include <syscall.h>
+#include <pagetable.h>
+#include <swap.h>
+#include <vmstat.h>
+#include <textcache.h>
+#include <elf.h>
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
  * enough to struggle off the ground. You should replace all of this
@@ -59,152 +65,589 @@
 /* (this must be > 64K so argument blocks of size ARG_MAX will fit) */
 #define DUMBVM_STACKPAGES    18
 
+void
+vm_bootstrap(void)
+{
+	init_coremap();
+	swap_bootstrap();
+	textcache_bootstrap();
+}
+
 /*
- * Wrap ram_stealmem in a spinlock.
+ * Physical page allocation is done by the coremap (vm/coremap.c).
  */
+paddr_t
+getppages(unsigned long npages)
+{
+	return coremap_alloc(npages);
+}
 
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+void
+freeppages(paddr_t paddr)
+{
+	coremap_free(paddr);
+}
 
-//static struct coremap_entry **coremap;
-//static int coremap_sz;
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(unsigned npages)
+{
+	paddr_t pa;
+	pa = getppages(npages);
+	if (pa==0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
 
 void
-init_coremap(void){
-	uint32_t firstpaddr = 0; // address of first free physical page 
-	uint32_t lastpaddr = 0; // one past end of last free physical page
-	int i;
-	ram_getsize(&firstpaddr, &lastpaddr);
-	DEBUG(DB_VM,"ram_getsize: %d %d\n", firstpaddr, lastpaddr);
+free_kpages(vaddr_t addr)
+{
+	freeppages(KVADDR_TO_PADDR(addr));
+}
 
-	coremap_sz = (lastpaddr-firstpaddr)/PAGE_SIZE;
-	coremap = kmalloc(sizeof(struct coremap_entry*) * coremap_sz);
-	
-	for (i = 0; i < coremap_sz; i++) {
-		struct coremap_entry *entry = kmalloc(sizeof(struct coremap_entry));
-		entry->paddr = firstpaddr + (i * PAGE_SIZE);
-		entry->valid = 0;
-		entry->block_len = -1;
-		coremap[i] = entry;
-	}
-	
-	coremap_ready = 1;
+/*
+ * State for the UTLB refill handler.
+ */
+void *mips_utlb_ptdir[MAXCPUS];
+unsigned mips_utlb_nfast[MAXCPUS];
+unsigned mips_utlb_nslow[MAXCPUS];
 
-	ram_getsize(&firstpaddr, &lastpaddr);
-	
-	for(i = 0; coremap[i]->paddr < firstpaddr; i++) {
-		coremap[i]->valid = 1;
+void
+vm_utlb_setpt(struct pagetable *pt)
+{
+	int spl;
+
+	spl = splhigh();
+	mips_utlb_ptdir[curcpu->c_number] = pt ? pt->pt_dir : NULL;
+	splx(spl);
+}
+
+void
+vm_utlb_printstats(void)
+{
+	unsigned i;
+
+	for (i=0; i<MAXCPUS; i++) {
+		if (mips_utlb_nfast[i] == 0 && mips_utlb_nslow[i] == 0) {
+			continue;
+		}
+		kprintf("cpu%u: %u fast TLB refills, %u slow\n",
+			i, mips_utlb_nfast[i], mips_utlb_nslow[i]);
 	}
+}
 
+void
+vm_tlbshootdown_all(void)
+{
+	int i, spl;
+
+	spl = splhigh();
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	tlb_setpid(asid_current());
+	splx(spl);
 }
 
+/*
+ * The page is only in this CPU's TLB if the address space has a
+ * current ID here, and then it's tagged with that ID.
+ */
 void
-vm_bootstrap(void){
-//	init_coremap(); /* Do nothing. */
-//	(void) stealmem_lock;
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	uint32_t id, ehi;
+	int i, spl;
+
+	spl = splhigh();
+	id = asid_lookup(ts->ts_as);
+	if (id == 0) {
+		splx(spl);
+		return;
+	}
+	ehi = (ts->ts_vaddr & TLBHI_VPAGE) | (id << TLBHI_PIDSHIFT);
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	tlb_setpid(asid_current());
+	splx(spl);
 }
 
-paddr_t
-getppages(unsigned long npages)
+void
+vm_tlbshootdown_page(struct addrspace *as, vaddr_t vaddr)
 {
-	paddr_t addr;
+	struct tlbbatch tb;
 
-	spinlock_acquire(&stealmem_lock);
+	vm_tlbbatch_init(&tb, as);
+	vm_tlbbatch_add(&tb, vaddr);
+	vm_tlbbatch_flush(&tb);
+}
 
-	addr = ram_stealmem(npages);
+void
+vm_tlbbatch_init(struct tlbbatch *tb, struct addrspace *as)
+{
+	tb->tb_as = as;
+	tb->tb_num = 0;
+}
 
-	spinlock_release(&stealmem_lock);
+void
+vm_tlbbatch_add(struct tlbbatch *tb, vaddr_t vaddr)
+{
+	if (tb->tb_num == TLBSHOOTDOWN_ALL) {
+		return;
+	}
+	if (tb->tb_num == TLBSHOOTDOWN_MAX) {
+		tb->tb_num = TLBSHOOTDOWN_ALL;
+		return;
+	}
+	tb->tb_pages[tb->tb_num].ts_as = tb->tb_as;
+	tb->tb_pages[tb->tb_num].ts_vaddr = vaddr;
+	tb->tb_num++;
+}
 
-/*	if(coremap_ready == 0)
-		return ram_stealmem(npages);
+void
+vm_tlbbatch_flush(struct tlbbatch *tb)
+{
+	uint32_t mask;
+	unsigned nipis;
+	int i, spl;
+
+	if (tb->tb_num == 0) {
+		return;
+	}
 
-	int i, j;
-	unsigned int count = 0;
-	for (i = 0; i < coremap_sz; i++) {
-		if (coremap[i]->valid) {
-			count = 0;
-		} else {
-			count++;
+	/*
+	 * Do this CPU's TLB ourselves, with interrupts off so we stay
+	 * on it. Other CPUs only need telling if the address space has
+	 * run there.
+	 */
+	spl = splhigh();
+	if (tb->tb_num == TLBSHOOTDOWN_ALL) {
+		vm_tlbshootdown_all();
+	}
+	else {
+		for (i=0; i<tb->tb_num; i++) {
+			vm_tlbshootdown(&tb->tb_pages[i]);
 		}
-		if (count == npages) {
-			coremap[i - npages + 1]->block_len = npages;
-			for (j = i - npages + 1; j <= i; j++) {
-				coremap[j]->valid = 1;
-			}
-			addr = coremap[i - npages + 1]->paddr;
-			// DEBUG(DB_VM, "getppages: coremap_ready-addr 0x%x\n", addr);
- 			return addr;
+	}
+	mask = asid_cpumask(tb->tb_as) & ~((uint32_t)1 << curcpu->c_number);
+	splx(spl);
+
+	nipis = 0;
+	if (mask != 0) {
+		nipis = ipi_tlbshootdown_cpus(mask, tb->tb_pages,
+					      tb->tb_num);
+	}
+
+	vmstat_inc(VS_SHOOTDOWNS);
+	if (tb->tb_num == TLBSHOOTDOWN_ALL) {
+		vmstat_inc(VS_SHOOTFULL);
+	}
+	else {
+		vmstat_add(VS_SHOOTPAGES, tb->tb_num);
+	}
+	vmstat_add(VS_SHOOTIPIS, nipis);
+
+	tb->tb_num = 0;
+}
+
+void
+vm_tlbshootdown_printstats(void)
+{
+	unsigned counts[VS_NCOUNTERS];
+	unsigned i, per100;
+
+	for (i=0; i<MAXCPUS; i++) {
+		vmstat_getcpu(i, counts);
+		if (counts[VS_SHOOTDOWNS] == 0) {
+			continue;
 		}
-	}*/
-	return addr;
+		per100 = counts[VS_SHOOTIPIS] * 100 / counts[VS_SHOOTDOWNS];
+		kprintf("cpu%u: %u shootdowns (%u pages, %u full flushes), "
+			"%u IPIs sent, %u.%02u per shootdown\n",
+			i, counts[VS_SHOOTDOWNS], counts[VS_SHOOTPAGES],
+			counts[VS_SHOOTFULL], counts[VS_SHOOTIPIS],
+			per100 / 100, per100 % 100);
+	}
 }
 
-/* Allocate/free some kernel-space virtual pages */
-vaddr_t
-alloc_kpages(unsigned npages)
+unsigned vm_faultaround;
+
+/*
+ * Put EHI/ELO in this CPU's TLB. If there is already an entry for the
+ * page (e.g. a read-only one we're upgrading), replace it; otherwise
+ * use a free slot if there is one, and a random one if not. Returns
+ * false, doing nothing, if the page was there and REPLACE is false.
+ * Call with interrupts off.
+ *
+ * The entry is tagged with the current address space ID. Every path
+ * below ends by writing it to ENTRYHI, which leaves the ID in place.
+ */
+static
+bool
+vm_tlb_write(uint32_t ehi, uint32_t elo, bool replace)
 {
-	paddr_t pa;
-	pa = getppages(npages);
-	if (pa==0) {
-		return 0;
+	uint32_t oehi, oelo;
+	int i;
+
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		if (replace) {
+			tlb_write(ehi, elo, i);
+		}
+		return replace;
 	}
-	return PADDR_TO_KVADDR(pa);
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_read(&oehi, &oelo, i);
+		if (oelo & TLBLO_VALID) {
+			continue;
+		}
+		tlb_write(ehi, elo, i);
+		return true;
+	}
+
+	tlb_random(ehi, elo);
+	return true;
 }
 
+/*
+ * Load the translation in PTE for VADDR into this CPU's TLB.
+ *
+ * The PTE is read with interrupts off: if the page is being paged out
+ * it may already have been shot down, and then we must not put it
+ * back. The access just faults again.
+ */
+static
 void
-free_kpages(vaddr_t addr)
+vm_tlb_load(vaddr_t vaddr, pte_t *pte)
 {
-	(void) addr;
-	/* nothing - leak the memory. */
-/*	paddr_t paddr = KVADDR_TO_PADDR(addr);
-	int i, j;
-	for (i = 0; coremap[i]->paddr != paddr; i++);
-	
-	KASSERT(coremap[i]->block_len != -1);
-	
-	for (j = 0; j < coremap[i]->block_len; j++) {
-		coremap[j]->valid = 0;
+	uint32_t ehi;
+	int spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+	if (*pte & PTE_VALID) {
+		ehi = (vaddr & TLBHI_VPAGE) |
+			(asid_current() << TLBHI_PIDSHIFT);
+		vm_tlb_write(ehi, *pte & PTE_TLBMASK, true);
 	}
-	
-	coremap[i]->block_len = -1;
-*/
+	splx(spl);
 }
 
+/*
+ * Load the translation for VADDR as vm_tlb_load does, and with it
+ * those of the resident pages of RG in the vm_faultaround + 1 page
+ * window VADDR falls in. The neighbours are loaded first, so that
+ * none of them can take the slot of the page actually wanted. They
+ * aren't marked referenced; they haven't been yet.
+ */
+static
 void
-vm_tlbshootdown_all(void)
+vm_tlb_loadaround(struct addrspace *as, struct region *rg,
+		  vaddr_t vaddr, pte_t *pte)
 {
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	vaddr_t start, end, va;
+	unsigned window, asid, nloaded;
+	pte_t *npte;
+	int spl;
+
+	window = vm_faultaround + 1;
+	if (window == 1 || rg == NULL || rg->rg_advice == MADV_RANDOM) {
+		vm_tlb_load(vaddr, pte);
+		return;
+	}
+	if (window > FAULTAROUND_MAX + 1) {
+		window = FAULTAROUND_MAX + 1;
+	}
+
+	start = vaddr - (vaddr / PAGE_SIZE % window) * PAGE_SIZE;
+	if (start < rg->rg_vbase) {
+		start = rg->rg_vbase;
+	}
+	end = start + window * PAGE_SIZE;
+	if (end > rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+		end = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+	}
+
+	nloaded = 0;
+	spl = splhigh();
+	asid = asid_current();
+	for (va = start; va < end; va += PAGE_SIZE) {
+		if (va == vaddr) {
+			continue;
+		}
+		npte = pt_lookup(as->as_pt, va, false);
+		if (npte == NULL || (*npte & PTE_VALID) == 0) {
+			continue;
+		}
+		if (vm_tlb_write((va & TLBHI_VPAGE) |
+				 (asid << TLBHI_PIDSHIFT),
+				 *npte & PTE_TLBMASK, false)) {
+			nloaded++;
+		}
+	}
+	if (*pte & PTE_VALID) {
+		vm_tlb_write((vaddr & TLBHI_VPAGE) | (asid << TLBHI_PIDSHIFT),
+			     *pte & PTE_TLBMASK, true);
+	}
+	splx(spl);
+
+	vmstat_add(VS_FAULTAROUND, nloaded);
 }
 
+/*
+ * Sequential access (MADV_SEQUENTIAL). After a fault at VADDR, page in
+ * the next VM_READAHEAD pages, so the walk finds them resident, and
+ * let the pager have the page VM_READBEHIND pages back first, since
+ * it won't be wanted again soon.
+ */
+#define VM_READAHEAD	4
+#define VM_READBEHIND	8
+
+static
 void
-vm_tlbshootdown(const struct tlbshootdown *ts)
+vm_readahead(struct addrspace *as, struct region *rg, vaddr_t vaddr)
 {
-	(void)ts;
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	vaddr_t va, end;
+	pte_t *pte;
+
+	if (rg->rg_advice != MADV_SEQUENTIAL) {
+		return;
+	}
+
+	if (vaddr >= rg->rg_vbase + VM_READBEHIND * PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, vaddr - VM_READBEHIND * PAGE_SIZE,
+				false);
+		if (pte != NULL) {
+			coremap_deactivate(pte);
+		}
+	}
+
+	end = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+	for (va = vaddr + PAGE_SIZE;
+	     va < end && va <= vaddr + VM_READAHEAD * PAGE_SIZE;
+	     va += PAGE_SIZE) {
+		if (vm_prefault(as, va)) {
+			break;
+		}
+	}
 }
 
+/*
+ * Fault on a page that isn't resident. It has to be inside one of the
+ * regions, or just below the stack, which then grows to cover it; if
+ * so, give it a frame and fill it from swap if it was
+ * paged out, and otherwise from the region's backing (zeros, or the
+ * executable for program segments). Program text is shared through
+ * the text cache instead.
+ *
+ * Unless LOAD is false (paging in ahead of use), the page is also
+ * loaded into the TLB, and if the region is being read sequentially
+ * the pages just ahead are paged in too.
+ *
+ * Fresh pages are clean and mapped read-only, unless this is a write,
+ * so that the first write to them is noticed and the page marked
+ * dirty.
+ */
+static
 int
-vm_fault(int faulttype, vaddr_t faultaddress)
+vm_fault_pagein(struct addrspace *as, vaddr_t faultaddress, int faulttype,
+		bool load)
 {
-	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
+	struct region *rg;
+	pte_t *pte, entry;
 	paddr_t paddr;
-	unsigned int i;
-	uint32_t ehi, elo;
+	int result;
+
+	rg = as_find_region(as, faultaddress);
+	if (rg == NULL) {
+		/* Maybe the stack needs to grow. */
+		if (as_grow_stack(as, faultaddress)) {
+			return EFAULT;
+		}
+		rg = as_find_region(as, faultaddress);
+		KASSERT(rg == &as->as_stack);
+		vmstat_inc(VS_STACKGROWS);
+	}
+	pte = pt_lookup(as->as_pt, faultaddress, true);
+	if (pte == NULL) {
+		return ENOMEM;
+	}
+	if (coremap_pin(pte)) {
+		/* Resident after all; let the access retry. */
+		coremap_unpin(*pte & PTE_FRAME);
+		return 0;
+	}
+
+	/* Only we change a non-resident entry, so this is stable. */
+	entry = *pte;
+
+	if ((entry & PTE_SWAPPED) == 0 && textcache_istext(rg)) {
+		result = textcache_get(as, rg, faultaddress, &paddr);
+		if (result == 0) {
+			/*
+			 * Shared, so not pageable, and never written:
+			 * no need to pin it.
+			 */
+			*pte = paddr | PTE_VALID;
+			if (load) {
+				vm_tlb_loadaround(as, rg, faultaddress, pte);
+				vm_readahead(as, rg, faultaddress);
+			}
+			return 0;
+		}
+		if (result != ENOENT) {
+			return result;
+		}
+	}
+
+	if (entry & PTE_SWAPPED) {
+		paddr = coremap_alloc_upage(as, faultaddress);
+	}
+	else {
+		paddr = coremap_alloc_zupage(as, faultaddress);
+	}
+	if (paddr == 0) {
+		return ENOMEM;
+	}
+
+	if (entry & PTE_SWAPPED) {
+		vmstat_inc(VS_SWAPINS);
+		result = swap_in(PTE_SWAPSLOT(entry), paddr);
+		if (result == 0) {
+			coremap_setswapslot(paddr, PTE_SWAPSLOT(entry));
+		}
+	}
+	else {
+		vmstat_inc(rg->rg_vnode == NULL ? VS_ZEROFILLS : VS_FILEINS);
+		result = as_fill_page(rg, faultaddress, paddr);
+	}
+	if (result) {
+		coremap_free_upage(paddr, as);
+		return result;
+	}
+
+	if ((entry & PTE_SWAPPED) && rg->rg_mmap == MAP_SHARED) {
+		/* Its file hasn't seen these contents yet. */
+		coremap_setdirty(paddr, as, faultaddress);
+	}
+
+	entry = paddr | PTE_VALID;
+	if (faulttype != VM_FAULT_READ && (rg->rg_perms & PF_W)) {
+		coremap_setdirty(paddr, as, faultaddress);
+		entry |= PTE_WRITE;
+	}
+	*pte = entry;
+
+	if (load) {
+		vm_tlb_loadaround(as, rg, faultaddress, pte);
+	}
+	coremap_unpin(paddr);
+	if (load) {
+		vm_readahead(as, rg, faultaddress);
+	}
+	return 0;
+}
+
+/*
+ * Write to a resident page that is mapped read-only. If the region is
+ * writeable, either the page is clean and this is the first write to
+ * it, or it is shared copy-on-write: take it over if we're the last
+ * one using it, and otherwise make our own copy. Either way the page
+ * we end up with is dirty. (Pages of MAP_SHARED file mappings are
+ * never copied; everyone sharing them is meant to see the write.)
+ */
+static
+int
+vm_fault_write(struct addrspace *as, vaddr_t faultaddress, pte_t *pte)
+{
+	struct region *rg;
+	paddr_t oldpaddr, newpaddr;
+
+	rg = as_find_region(as, faultaddress);
+	if (rg == NULL || (rg->rg_perms & PF_W) == 0) {
+		/* Write to a page mapped read-only: not allowed. */
+		return EFAULT;
+	}
+
+	if (!coremap_pin(pte)) {
+		/* Paged out under us; let the access fault it back in. */
+		return 0;
+	}
+
+	oldpaddr = *pte & PTE_FRAME;
+	if (coremap_refcount(oldpaddr) == 1 || rg->rg_mmap == MAP_SHARED) {
+		vmstat_inc(VS_DIRTYFAULTS);
+		coremap_setdirty(oldpaddr, as, faultaddress);
+		*pte |= PTE_WRITE;
+		vm_tlb_load(faultaddress, pte);
+		coremap_unpin(oldpaddr);
+		return 0;
+	}
+
+	newpaddr = coremap_alloc_upage(as, faultaddress);
+	if (newpaddr == 0) {
+		coremap_unpin(oldpaddr);
+		return ENOMEM;
+	}
+	vmstat_inc(VS_COWCOPIES);
+	memmove((void *)PADDR_TO_KVADDR(newpaddr),
+		(const void *)PADDR_TO_KVADDR(oldpaddr), PAGE_SIZE);
+	coremap_setdirty(newpaddr, as, faultaddress);
+	*pte = newpaddr | PTE_VALID | PTE_WRITE;
+
+	/* Drop our reference to the shared copy. */
+	coremap_free_upage(oldpaddr, as);
+
+	vm_tlb_load(faultaddress, pte);
+	coremap_unpin(newpaddr);
+	return 0;
+}
+
+/*
+ * Don't page anything out just for a guess about the future.
+ */
+#define VM_PREFAULT_MINFREE	16
+
+int
+vm_prefault(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned nused, nfree;
+	pte_t *pte;
+
+	vaddr &= PAGE_FRAME;
+	if (as_find_region(as, vaddr) == NULL) {
+		return EFAULT;
+	}
+	pte = pt_lookup(as->as_pt, vaddr, false);
+	if (pte != NULL && (*pte & PTE_VALID)) {
+		return 0;
+	}
+	coremap_getstats(&nused, &nfree);
+	if (nfree < VM_PREFAULT_MINFREE) {
+		return ENOMEM;
+	}
+
+	vmstat_inc(VS_PREFAULTS);
+	return vm_fault_pagein(as, vaddr, VM_FAULT_READ, false);
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
 	struct addrspace *as;
-	int spl;
-	bool textseg = false;	
+	pte_t *pte;
 
 	faultaddress &= PAGE_FRAME;
 
 	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
-
-	as = proc_getas();
+	vmstat_inc(VS_FAULTS);
 
 	switch (faulttype) {
 	    case VM_FAULT_READONLY:
-		if(as->isloaded){
-			sys__exit(-1);	
-		}	
-//		panic("dumbvm: got VM_FAULT_READONLY\n");
 	    case VM_FAULT_READ:
 	    case VM_FAULT_WRITE:
 		break;
@@ -221,6 +664,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		return EFAULT;
 	}
 
+	as = proc_getas();
 	if (as == NULL) {
 		/*
 		 * No address space set up. This is probably also a
@@ -229,121 +673,35 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		return EFAULT;
 	}
 
-	//TLB miss error is found. How to fix it?
-	//Try going through the ptable and check if the fault address we got has a page in the page table or not. we should have one, check if its valid or not.
-/*	struct page *p;
-	for(i = 0; i < array_num(as->ptable); i++){
-		p = array_get(as->ptable, i);
-		if(p->vaddr == faultaddress)
-		{
-			//Check if page is valid
-			if(p->valid == 0){
-				//We have got ourselves a page fault
-				paddr = getppages(1);
-				if(!paddr){
-					return ENOMEM;
-				}
-				p->paddr = paddr;
-				p->valid = 1;
-
-				if (as->as_pbase1 == 0 && faultaddress >= as->as_vbase1 && faultaddress < as->as_vbase1 + as->as_npages1 * PAGE_SIZE)
-				{
-					as->as_pbase1 = paddr;
-				}
-				if (as->as_pbase2 == 0 && faultaddress >= as->as_vbase2 && faultaddress < as->as_vbase2 + as->as_npages2 * PAGE_SIZE)
-				{
-					as->as_pbase2 = paddr;
-				}
-				if (as->as_stackpbase == 0 && faultaddress >= USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE && faultaddress < USERSTACK)
-				{
-					as->as_stackpbase = paddr;
-				}
-			}else{
-				paddr = p->paddr;
-			}
-			break;
-		}
-	} 
-	
-	if(p->perms & 0x2)
-		textseg = true;
-*/
-	/* Assert that the address space has been set up properly. */
-	KASSERT(as->as_vbase1 != 0);
-	KASSERT(as->as_pbase1 != 0);
-	KASSERT(as->as_npages1 != 0);
-	KASSERT(as->as_vbase2 != 0);
-	KASSERT(as->as_pbase2 != 0);
-	KASSERT(as->as_npages2 != 0);
-	KASSERT(as->as_stackpbase != 0);
-	KASSERT((as->as_vbase1 & PAGE_FRAME) == as->as_vbase1);
-	KASSERT((as->as_pbase1 & PAGE_FRAME) == as->as_pbase1);
-	KASSERT((as->as_vbase2 & PAGE_FRAME) == as->as_vbase2);
-	KASSERT((as->as_pbase2 & PAGE_FRAME) == as->as_pbase2);
-	KASSERT((as->as_stackpbase & PAGE_FRAME) == as->as_stackpbase);
-
-	vbase1 = as->as_vbase1;
-	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
-	vbase2 = as->as_vbase2;
-	vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
-	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
-	stacktop = USERSTACK;
-	if (faultaddress >= vbase1 && faultaddress < vtop1) {
-		paddr = (faultaddress - vbase1) + as->as_pbase1;
-		textseg = true;
-	}
-	else if (faultaddress >= vbase2 && faultaddress < vtop2) {
-		paddr = (faultaddress - vbase2) + as->as_pbase2;
-	}
-	else if (faultaddress >= stackbase && faultaddress < stacktop) {
-		paddr = (faultaddress - stackbase) + as->as_stackpbase;
-	}
-	else {
+	if (faultaddress >= USERSPACETOP) {
 		return EFAULT;
 	}
 
-	/* make sure it's page-aligned */
-	KASSERT((paddr & PAGE_FRAME) == paddr);
-	
-	/* Disable interrupts on this CPU while frobbing the TLB. */
-	spl = splhigh();
+	/*
+	 * Note that a READONLY fault can find the page gone: it may
+	 * have been paged out between the fault and now.
+	 */
+	pte = pt_lookup(as->as_pt, faultaddress, false);
+	if (pte == NULL || (*pte & PTE_VALID) == 0) {
+		return vm_fault_pagein(as, faultaddress, faulttype, true);
+	}
 
-//	DEBUG(DB_VM, "dumbvm: For loop will now begin. 0x%x -> 0x%x\n", faultaddress, paddr);
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_read(&ehi, &elo, i);
-		if (elo & TLBLO_VALID) {
-			continue;
+	if (faulttype == VM_FAULT_READ || (*pte & PTE_WRITE)) {
+		/* Just a TLB miss. */
+		vmstat_inc(VS_RELOADS);
+		coremap_touch(pte, as, faultaddress);
+		if (vm_faultaround > 0) {
+			vm_tlb_loadaround(as,
+				as_find_region(as, faultaddress),
+				faultaddress, pte);
+		}
+		else {
+			vm_tlb_load(faultaddress, pte);
 		}
-		ehi = faultaddress;
-		if(textseg && as->isloaded)
-        	{
-               // 	kprintf("Abuot to set dirty bits to 0");
-                	elo = (paddr & ~TLBLO_DIRTY) | TLBLO_VALID;
-        	}else{
-                	elo = paddr | TLBLO_DIRTY | TLBLO_VALID;        
-        	}	
-		tlb_write(ehi, elo, i);
-		splx(spl);
 		return 0;
 	}
-	
-	ehi = faultaddress;
-	
-	if(textseg && as->isloaded)
-	{
-	//	kprintf("Abuot to set dirty bits to 0");
-		elo = (paddr & ~TLBLO_DIRTY) | TLBLO_VALID;
-	}else{
-		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;	
-	}
 
-	tlb_random(ehi, elo);
-	splx(spl);
-	return 0;
-	
-	kprintf("dumbvm: Ran out of TLB entries - cannot handle page fault\n");
-	splx(spl);
-	return EFAULT;
+	return vm_fault_write(as, faultaddress, pte);
 }
 
 /*
@@ -231,14 +231,19 @@ sfs_fsync(struct vnode *v)
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). Regular files can always be mapped; the pages
+ * are read and written back through sfs_read and sfs_write.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v, int prot)
 {
-	(void)v;
-	return ENOSYS;
+	struct sfs_vnode *sv = v->vn_data;
+
+	(void)prot;
+
+	KASSERT(sv->sv_i.sfi_type == SFS_TYPE_FILE);
+	return 0;
 }
 
 /*
@@ -39,6 +39,7 @@
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct pagetable;
 
 
 /*
@@ -48,13 +49,49 @@ struct vnode;
  * You write this.
  */
 
-struct page{
-	vaddr_t vaddr;
-	paddr_t paddr;
-	int perms;
-	int valid;	
+#if !OPT_DUMBVM
+/*
+ * A region of the address space: a run of pages with the same
+ * permissions (PF_R/PF_W/PF_X bits from the ELF header). Pages in a
+ * region are not backed by memory until they are first touched.
+ *
+ * A region may be backed by part of a file (an ELF segment): the
+ * RG_FILESZ bytes starting at virtual address RG_SEGSTART come from
+ * RG_VNODE at offset RG_FILEOFF, and everything else is zero. The
+ * region holds a reference to the vnode.
+ *
+ * Regions made by mmap have RG_MMAP set to MAP_SHARED or MAP_PRIVATE;
+ * it is 0 for everything else. Changes to MAP_SHARED pages are
+ * written back to the file on munmap, fsync and exit.
+ *
+ * RG_ADVICE is the access pattern last given for the region with
+ * madvise (MADV_NORMAL, MADV_RANDOM or MADV_SEQUENTIAL). It applies
+ * to the whole region, even if only part of it was named.
+ */
+struct region {
+	vaddr_t rg_vbase;
+	size_t rg_npages;
+	int rg_perms;
+
+	struct vnode *rg_vnode;		/* backing file, or NULL */
+	off_t rg_fileoff;		/* file offset of rg_segstart */
+	vaddr_t rg_segstart;		/* first address with file data */
+	size_t rg_filesz;		/* bytes of file data */
+	int rg_mmap;			/* MAP_SHARED/MAP_PRIVATE, or 0 */
+	int rg_advice;			/* MADV_NORMAL etc. */
 };
 
+/*
+ * The user stack starts out one page long and grows down a page at a
+ * time as it's touched, up to STACK_MAXPAGES. That much address space
+ * is set aside for it (less anything already in the way), and nothing
+ * else is put within STACK_GUARDPAGES below it, so a runaway stack
+ * faults instead of running into the heap or a mapping.
+ */
+#define STACK_MAXPAGES		1024	/* 4M */
+#define STACK_GUARDPAGES	16
+#endif
+
 struct addrspace {
 #if OPT_DUMBVM
         vaddr_t as_vbase1;
@@ -65,16 +102,14 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
-	vaddr_t as_vbase1;
-        paddr_t as_pbase1;
-        size_t as_npages1;
-        vaddr_t as_vbase2;
-        paddr_t as_pbase2;
-        size_t as_npages2;
-        paddr_t as_stackpbase;       
  /* Put stuff here for your VM system */
-	struct array *ptable;
-	bool isloaded;
+	struct array *as_regions;	/* struct region * */
+	struct region as_heap;		/* pages up to the break */
+	vaddr_t as_heaptop;		/* the break */
+	struct region as_stack;		/* pages touched so far */
+	vaddr_t as_stacklimit;		/* how far down it may grow */
+	struct pagetable *as_pt;
+	struct asid_set as_asids;	/* TLB address space IDs */
 #endif
 };
 
@@ -134,6 +169,71 @@ int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 
+#if !OPT_DUMBVM
+/*
+ * as_find_region - return the region containing VADDR, or NULL.
+ *
+ * as_define_backing - make the region containing VADDR load FILESZ
+ *                bytes from V at OFFSET on demand, starting at VADDR.
+ *
+ * as_filedata - find the part of the page at VADDR in region RG that
+ *                comes from its file: LEN bytes, PAGEOFF bytes into
+ *                the page, from file offset OFFSET. Returns false if
+ *                the page has no file data.
+ *
+ * as_fill_page - fill the frame PADDR, which must already be zeroed,
+ *                with the initial contents of the page at VADDR in
+ *                region RG. Called on first touch of the page.
+ *
+ * as_mmap     - map LEN bytes of V from OFFSET (page-aligned) at an
+ *                address of our choosing, handing it back. FILESIZE is
+ *                the current size of the file; pages past it are
+ *                zero-filled. FLAGS is MAP_SHARED or MAP_PRIVATE.
+ *
+ * as_munmap   - remove the mappings in [VADDR, VADDR+LEN), writing
+ *                back MAP_SHARED ones. Mappings can only be removed
+ *                whole.
+ *
+ * as_msync_vnode - write back the modified pages of every MAP_SHARED
+ *                mapping of V.
+ *
+ * as_grow_stack - extend the stack down to cover VADDR, if that's
+ *                within its limit. Called for faults outside any region.
+ *
+ * as_madvise  - act on ADVICE (MADV_*) for [VADDR, VADDR+LEN), which
+ *                must all be mapped.
+ *
+ * as_mincore  - fill VEC with the MINCORE_* bits for each of NPAGES
+ *                pages from VADDR, which must all be mapped.
+ *
+ * as_sbrk     - move the break by AMOUNT bytes, handing back the old
+ *                break. The heap starts out empty just past the last
+ *                segment of the executable. Pages it grows by are
+ *                zero-filled when first touched; pages it shrinks by
+ *                are released at once.
+ */
+struct region    *as_find_region(struct addrspace *as, vaddr_t vaddr);
+int               as_define_backing(struct addrspace *as, vaddr_t vaddr,
+                                    struct vnode *v, off_t offset,
+                                    size_t filesz);
+bool              as_filedata(struct region *rg, vaddr_t vaddr,
+                              off_t *offset, size_t *pageoff, size_t *len);
+int               as_fill_page(struct region *rg, vaddr_t vaddr,
+                               paddr_t paddr);
+int               as_mmap(struct addrspace *as, size_t len, int prot,
+                          int flags, struct vnode *v, off_t offset,
+                          off_t filesize, vaddr_t *ret);
+int               as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len);
+int               as_msync_vnode(struct addrspace *as, struct vnode *v);
+int               as_grow_stack(struct addrspace *as, vaddr_t vaddr);
+int               as_madvise(struct addrspace *as, vaddr_t vaddr,
+                             size_t len, int advice);
+int               as_mincore(struct addrspace *as, vaddr_t vaddr,
+                             size_t npages, unsigned char *vec);
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbreak);
+#endif
+
 
 /*
  * Functions in loadelf.c
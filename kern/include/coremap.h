@@ -1,45 +1,191 @@
 /*
- *  * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
- *   *      The President and Fellows of Harvard College.
- *    *
- *     * Redistribution and use in source and binary forms, with or without
- *      * modification, are permitted provided that the following conditions
- *       * are met:
- *        * 1. Redistributions of source code must retain the above copyright
- *         *    notice, this list of conditions and the following disclaimer.
- *          * 2. Redistributions in binary form must reproduce the above copyright
- *           *    notice, this list of conditions and the following disclaimer in the
- *            *    documentation and/or other materials provided with the distribution.
- *             * 3. Neither the name of the University nor the names of its contributors
- *              *    may be used to endorse or promote products derived from this software
- *               *    without specific prior written permission.
- *                *
- *                 * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
- *                  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
- *                   * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
- *                    * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
- *                     * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
- *                      * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
- *                       * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
- *                        * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
- *                         * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
- *                          * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
- *                           * SUCH DAMAGE.
- *                            */
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
 
 #ifndef _COREMAP_H_
 #define _COREMAP_H_
 
-struct coremap_entry{
-        paddr_t paddr;
-        int valid;
-        int block_len;
+/*
+ * Coremap: the table of physical page frames.
+ *
+ * There is one entry per page of physical memory, indexed by physical
+ * page number. Frames below the first free page at VM bootstrap time
+ * (the kernel image, the coremap itself, and anything ram_stealmem
+ * handed out during early boot) are marked in use forever.
+ *
+ * An allocation of several contiguous frames is recorded by setting
+ * block_len in the entry for the first frame of the run; the other
+ * frames in the run have block_len -1. Free frames are managed by a
+ * buddy allocator (see coremap.c), so runs of any size are found and
+ * freed in time logarithmic in the size of memory.
+ *
+ * User pages can be shared between address spaces (copy-on-write
+ * after fork), so each run carries a reference count, kept in the
+ * entry for its first frame. coremap_alloc hands out runs with one
+ * reference; coremap_free drops one and only releases the frames when
+ * the last reference goes away.
+ *
+ * User pages are pageable. Each one records the address space and
+ * virtual address it is mapped at so the page table entry can be
+ * found when the frame is evicted. A frame shared by several address
+ * spaces has no single owner and is left alone until only one
+ * reference remains and that address space touches it again.
+ *
+ * The busy bit keeps a frame from changing under someone working on
+ * it: the pager sets it on its victim while writing it out, and the
+ * fault and fork/exit paths set it (coremap_pin) before changing a
+ * resident page. Anyone who finds a frame busy waits for it.
+ *
+ * The referenced bits used by the pager's clock live in a separate
+ * byte array, coremap_refbits, one byte per frame, because the UTLB
+ * refill handler sets them from assembly without taking any locks.
+ */
+
+#include <pagetable.h>
+
+struct addrspace;
+
+struct coremap_entry {
+	struct addrspace *as;	/* owner of a pageable user page, or NULL */
+	vaddr_t vaddr;		/* where the page is mapped in AS */
+	int block_len;		/* frames in the run starting here, or -1 */
+	unsigned refcount;	/* references to the run */
+	unsigned swapslot;	/* up-to-date copy in swap, or NOSLOT */
+	unsigned valid:1,	/* frame is allocated */
+		busy:1,		/* frame is pinned */
+		dirty:1,	/* contents differ from the backing store */
+		freehead:1,	/* first frame of a free buddy block */
+		order:5;	/* ...of 2^order frames */
+	unsigned fl_next;	/* buddy free list links (frame indexes) */
+	unsigned fl_prev;
+	uint8_t kmtag;		/* kmalloc's tag for a kernel heap page */
+	size_t kmsize;		/* ...and the size it was asked for */
 };
 
-static struct coremap_entry **coremap;
-static int coremap_sz;
-static volatile int coremap_ready = 0;
+/* Nonzero if the frame was used since the clock hand last passed. */
+extern volatile uint8_t *coremap_refbits;
+
+#define COREMAP_NOSLOT	0xffffffff
 
+/*
+ * Set up the coremap; called from vm_bootstrap. coremap_isready is
+ * true once it has run.
+ */
 void init_coremap(void);
+bool coremap_isready(void);
+
+/*
+ * Allocate NPAGES contiguous frames / release a run previously
+ * returned by coremap_alloc. Before init_coremap has run, allocation
+ * falls through to ram_stealmem and frees are ignored.
+ *
+ * If memory is short, coremap_alloc pages out user pages to make
+ * room, as long as the caller is in a position to sleep.
+ */
+paddr_t coremap_alloc(unsigned long npages);
+void coremap_free(paddr_t paddr);
+
+/* Add a reference to / count the references to a run. */
+void coremap_incref(paddr_t paddr);
+unsigned coremap_refcount(paddr_t paddr);
+
+/*
+ * User pages.
+ *
+ * coremap_alloc_upage - allocate a frame for VADDR in AS. It comes
+ *      back pinned and clean.
+ * coremap_alloc_zupage - likewise, but the frame is zero-filled. It
+ *      comes from the pool of frames zeroed by idle CPUs if possible.
+ * coremap_free_upage - drop AS's reference to a pinned frame, freeing
+ *      it if that was the last. Unpins it either way.
+ * coremap_pin - wait until the page PTE refers to is not being paged
+ *      out, then, if it's resident, pin its frame and return true.
+ *      Returns false if the page isn't resident.
+ * coremap_unpin - release a pinned frame.
+ * coremap_touch - note that the page PTE refers to (if resident) has
+ *      been used by AS at VADDR.
+ * coremap_setdirty - mark a pinned frame as modified. Any copy in swap
+ *      is discarded. If only one address space uses the frame, that
+ *      is AS, at VADDR.
+ * coremap_setclean - mark a pinned frame as matching its backing
+ *      store again (after it has been written back to its file).
+ * coremap_isdirty - check whether a pinned frame is modified.
+ * coremap_setswapslot - record that a pinned frame was just read from
+ *      swap slot SLOT and the slot still matches.
+ * coremap_setdiscard - the contents of a pinned frame no longer
+ *      matter: mark it clean, drop any copy in swap, and clear its
+ *      referenced bit so the pager takes it early.
+ * coremap_deactivate - clear the referenced bit of the page PTE refers
+ *      to, if it's resident, so the pager takes it early.
+ */
+paddr_t coremap_alloc_upage(struct addrspace *as, vaddr_t vaddr);
+paddr_t coremap_alloc_zupage(struct addrspace *as, vaddr_t vaddr);
+void coremap_free_upage(paddr_t paddr, struct addrspace *as);
+bool coremap_pin(pte_t *pte);
+void coremap_unpin(paddr_t paddr);
+void coremap_touch(pte_t *pte, struct addrspace *as, vaddr_t vaddr);
+void coremap_setdirty(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+void coremap_setclean(paddr_t paddr);
+bool coremap_isdirty(paddr_t paddr);
+void coremap_setswapslot(paddr_t paddr, unsigned slot);
+void coremap_setdiscard(paddr_t paddr);
+void coremap_deactivate(pte_t *pte);
+
+/*
+ * Kernel heap pages.
+ *
+ * coremap_setkmtag - record TAG (nonzero) and SIZE for the kernel
+ *      page at PADDR, so kmalloc can tell what kind of page it is, and
+ *      how big an allocation on it was, when it's freed. Both go away
+ *      when the page is freed. Pages allocated before init_coremap
+ *      can't be tagged.
+ * coremap_getkmtag - the tag of the page at PADDR, or 0, and if SIZE
+ *      isn't NULL the size recorded with it. Takes no lock: a page's
+ *      tag doesn't change while anything on it is allocated, which is
+ *      the only time kmalloc asks.
+ */
+void coremap_setkmtag(paddr_t paddr, unsigned tag, size_t size);
+unsigned coremap_getkmtag(paddr_t paddr, size_t *size);
+
+/*
+ * Zero one free frame for the pool used by coremap_alloc_zupage.
+ * Called by idle CPUs; returns false if there was nothing to do.
+ */
+bool coremap_zerofill(void);
+
+/*
+ * Frame accounting, in pages. Frames in the zero pool and in the
+ * per-CPU free frame caches count as used.
+ */
+void coremap_getstats(unsigned *nused, unsigned *nfree);
+void coremap_printstats(void);
+
+/* Print the sizes of the free blocks, for kheap_printstats. */
+void coremap_printfrag(void);
 
 #endif /* _COREMAP_H_ */
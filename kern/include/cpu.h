@@ -83,10 +83,16 @@ struct cpu {
 	 * struct tlbshootdown is machine-dependent and might
 	 * reasonably be either an address space and vaddr pair, or a
 	 * paddr, or something else.
+	 *
+	 * c_shootdown_queued counts shootdown requests sent to this
+	 * cpu and c_shootdown_done the ones it has carried out, so a
+	 * sender can wait for its request to finish.
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	int c_numshootdown;
+	uint32_t c_shootdown_queued;
+	uint32_t c_shootdown_done;
 	struct spinlock c_ipi_lock;
 };
 
@@ -153,6 +159,12 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_broadcast sends a TLB shootdown to all CPUs except
+ * the current one and waits for them to finish it.
+ * ipi_tlbshootdown_cpus sends the N shootdowns in MAPPINGS (or, if N
+ * is TLBSHOOTDOWN_ALL, a full flush) to each CPU whose bit is set in
+ * CPUMASK (bit N for cpu number N), with one IPI per CPU. It waits
+ * for them all to finish and returns the number of IPIs sent.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -167,6 +179,9 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown_cpus(uint32_t cpumask,
+			       const struct tlbshootdown *mappings, int n);
 
 void interprocessor_interrupt(void);
 
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Flags for mmap(), madvise() and mincore(), shared between the
+ * kernel and libc.
+ *
+ * Userland gets these (and the prototypes) from <sys/mman.h>.
+ */
+
+/* Protection; the prot argument */
+#define PROT_NONE	0x0	/* no access */
+#define PROT_READ	0x1	/* pages may be read */
+#define PROT_WRITE	0x2	/* pages may be written */
+#define PROT_EXEC	0x4	/* pages may be executed */
+
+/* Sharing; the flags argument (exactly one is required) */
+#define MAP_SHARED	0x1	/* changes go back to the file */
+#define MAP_PRIVATE	0x2	/* changes are private to the process */
+
+/* Advice; the advice argument to madvise */
+#define MADV_NORMAL	0	/* no particular pattern */
+#define MADV_RANDOM	1	/* no point loading neighbouring pages */
+#define MADV_SEQUENTIAL	2	/* read ahead, and drop what's behind */
+#define MADV_WILLNEED	3	/* page the range in now */
+#define MADV_DONTNEED	4	/* throw the pages away now */
+#define MADV_FREE	5	/* pages may be thrown away if memory is short */
+
+/* Bits in the bytes mincore hands back, one per page */
+#define MINCORE_INCORE	0x1	/* page is resident */
+
+
+#endif /* _KERN_MMAN_H_ */
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_VMSTAT_H_
+#define _KERN_VMSTAT_H_
+
+/*
+ * VM event counters, shared between the kernel and userland. The
+ * __vmstat() system call copies out the system-wide totals, indexed
+ * by these numbers; VMSTAT_NAMES describes each one.
+ */
+
+#define VS_FAULTS		0	/* calls to vm_fault */
+#define VS_RELOADS		1	/* ...that just reloaded the TLB */
+#define VS_ZEROFILLS		2	/* pages zero-filled on first touch */
+#define VS_FILEINS		3	/* pages read from a file */
+#define VS_SWAPINS		4	/* pages read from swap */
+#define VS_COWCOPIES		5	/* pages copied on write */
+#define VS_DIRTYFAULTS		6	/* writes that only marked a page dirty */
+#define VS_STACKGROWS		7	/* faults that grew the stack */
+#define VS_FRAMEALLOCS		8	/* frames allocated */
+#define VS_FRAMEFREES		9	/* frames freed */
+#define VS_ZEROHITS		10	/* zeroed frames from the idle pool */
+#define VS_ZEROMISSES		11	/* ...that had to be zeroed on the spot */
+#define VS_EVICTIONS		12	/* pages evicted */
+#define VS_SWAPOUTS		13	/* ...that were written to swap */
+#define VS_SHOOTDOWNS		14	/* TLB shootdowns */
+#define VS_SHOOTPAGES		15	/* pages shot down */
+#define VS_SHOOTFULL		16	/* shootdowns that flushed everything */
+#define VS_SHOOTIPIS		17	/* shootdown IPIs sent */
+#define VS_FAULTAROUND		18	/* neighbouring pages loaded with a miss */
+#define VS_TEXTSHARES		19	/* text pages found already in memory */
+#define VS_PREFAULTS		20	/* pages read ahead or paged in by madvise */
+#define VS_NCOUNTERS		21
+
+#define VMSTAT_NAMES { \
+	"TLB faults", \
+	"TLB reloads", \
+	"zero-fill page-ins", \
+	"file page-ins", \
+	"swap page-ins", \
+	"copy-on-write copies", \
+	"dirty-marking write faults", \
+	"stack growth faults", \
+	"frames allocated", \
+	"frames freed", \
+	"zero pool hits", \
+	"zero pool misses", \
+	"pages evicted", \
+	"pages written to swap", \
+	"TLB shootdowns", \
+	"pages shot down", \
+	"full TLB flushes", \
+	"shootdown IPIs sent", \
+	"pages loaded by fault-around", \
+	"text pages shared", \
+	"pages paged in ahead of use", \
+}
+
+
+#endif /* _KERN_VMSTAT_H_ */
@@ -123,8 +123,11 @@ uint32_t random(void);
  * Kernel heap memory allocation. Like malloc/free.
  * If out of memory, kmalloc returns NULL.
  *
- * kheap_nextgeneration, dump, and dumpall do nothing unless heap
- * labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
+ * kheap_dump and dumpall do nothing unless heap labeling (for leak
+ * detection) in kmalloc.c (q.v.) is enabled. kheap_profile turns the
+ * call-site heap profiler on and off at runtime; kheap_profreport
+ * prints the sites holding the most memory. kheap_nextgeneration
+ * starts a new generation for both.
  */
 void *kmalloc(size_t size);
 void kfree(void *ptr);
@@ -132,6 +135,8 @@ void kheap_printstats(void);
 void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
+void kheap_profile(bool on);
+void kheap_profreport(unsigned ntop);
 
 /*
  * C string functions.
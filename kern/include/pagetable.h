@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Two-level page table for user address spaces.
+ *
+ * A virtual address is split 10/10/12:
+ *
+ *    31        22 21        12 11          0
+ *   +------------+------------+-------------+
+ *   | dir index  | leaf index |   offset    |
+ *   +------------+------------+-------------+
+ *
+ * The directory holds pointers (kseg0 addresses) to leaf pages; each
+ * leaf page holds 1024 page table entries. Leaves are only allocated
+ * once something in the 4M of address space they cover is touched.
+ * Only kuseg is mapped, so the directory needs just enough slots to
+ * reach USERSPACETOP.
+ *
+ * Page table entries are laid out like the TLB's EntryLo word, so a
+ * resident entry can be handed to the TLB after masking off the
+ * software bits: the frame address, TLBLO_DIRTY (meaning "writes
+ * allowed") and TLBLO_VALID (meaning "resident").
+ *
+ * A non-resident page is described by the software bits. A page that
+ * has been swapped out holds its swap slot in the frame field and has
+ * PTE_SWAPPED set. While a page is on its way out PTE_INTRANSIT is
+ * set and faults on it have to wait. An entry of 0 means the page has
+ * never been touched, or was clean and can be loaded again from its
+ * file (or zero-filled).
+ */
+
+#include <machine/vm.h>
+#include <mips/tlb.h>
+
+typedef uint32_t pte_t;
+
+#define PT_DIR_SHIFT	22
+#define PT_LEAF_SHIFT	12
+#define PT_LEAF_MASK	0x3ff
+
+#define PT_NDIR		(USERSPACETOP >> PT_DIR_SHIFT)
+#define PT_NLEAF	(PAGE_SIZE / sizeof(pte_t))
+
+#define PT_DIR_INDEX(va)	((va) >> PT_DIR_SHIFT)
+#define PT_LEAF_INDEX(va)	(((va) >> PT_LEAF_SHIFT) & PT_LEAF_MASK)
+#define PT_VADDR(d, l)	\
+	(((vaddr_t)(d) << PT_DIR_SHIFT) | ((vaddr_t)(l) << PT_LEAF_SHIFT))
+
+/* PTE fields */
+#define PTE_FRAME	TLBLO_PPAGE	/* physical frame */
+#define PTE_WRITE	TLBLO_DIRTY	/* page may be written */
+#define PTE_VALID	TLBLO_VALID	/* page is resident */
+#define PTE_TLBMASK	(PTE_FRAME | PTE_WRITE | PTE_VALID)
+#define PTE_SWAPPED	0x00000001	/* page is in swap */
+#define PTE_INTRANSIT	0x00000002	/* page is being paged out */
+
+#define PTE_MKSWAP(slot)	(((pte_t)(slot) << PT_LEAF_SHIFT) | PTE_SWAPPED)
+#define PTE_SWAPSLOT(pte)	((pte) >> PT_LEAF_SHIFT)
+
+struct pagetable {
+	pte_t *pt_dir[PT_NDIR];
+};
+
+/*
+ * pt_create - allocate an empty page table.
+ * pt_destroy - free the page table and its leaves. The frames the
+ *              entries refer to are the caller's business.
+ * pt_lookup - return a pointer to the entry for VA. If the leaf
+ *              covering VA doesn't exist, allocate it if CREATE is
+ *              true, and otherwise return NULL. Also returns NULL if
+ *              allocation fails.
+ * pt_leaf - return leaf number DIR, or NULL if it isn't allocated.
+ *              For walking the whole table.
+ */
+struct pagetable *pt_create(void);
+void pt_destroy(struct pagetable *pt);
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t va, bool create);
+
+static inline
+pte_t *
+pt_leaf(struct pagetable *pt, unsigned dir)
+{
+	KASSERT(dir < PT_NDIR);
+	return pt->pt_dir[dir];
+}
+
+#endif /* _PAGETABLE_H_ */
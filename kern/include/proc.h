@@ -69,6 +69,12 @@ struct proc {
 	int exitcode;
 	bool exitdone;
 	struct cv *cv_waitpid;
+
+	/*
+	 * Set while a vforked child is still running in its parent's
+	 * address space; the parent is waiting on it.
+	 */
+	struct semaphore *p_vforksem;
 };
 
 //Handles the Process List. 
@@ -68,6 +68,7 @@ int sys_close(int fd);
 int sys_read(int fd, userptr_t buf, size_t size, int *retval);
 int sys_write(int fd, userptr_t buf, size_t size, int *retval);
 int sys_lseek(int fd, off_t offset, int code, off_t *retval);
+int sys_fsync(int fd);
 
 int sys_chdir(const_userptr_t path);
 int sys___getcwd(userptr_t buf, size_t buflen, int *retval);
@@ -76,10 +77,22 @@ int sys___getcwd(userptr_t buf, size_t buflen, int *retval);
 
 int sys_getpid(pid_t *pid);
 int sys_fork(struct trapframe *tf,pid_t *pid);
+int sys_vfork(struct trapframe *tf, pid_t *pid);
 int sys_waitpid(pid_t pid,int *status,int options,pid_t *retval);
 void sys__exit(int exitcode);
+void proc_exit(int status);
 int sys_execv(char *program,char **args);
 
+/* memory syscalls */
+
+int sys_sbrk(intptr_t amount, int *retval);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+	     off_t offset, int *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_madvise(userptr_t addr, size_t len, int advice);
+int sys_mincore(userptr_t addr, size_t len, userptr_t vec);
+int sys___vmstat(userptr_t counts, unsigned ncounts, int *retval);
+
 
 
 #endif /* _SYSCALL_H_ */
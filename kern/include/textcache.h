@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _TEXTCACHE_H_
+#define _TEXTCACHE_H_
+
+/*
+ * Shared program text.
+ *
+ * The read-only segments of an executable look the same in every
+ * process running it, so their pages are shared. The first process
+ * to touch one reads it in and enters the frame in the text cache,
+ * keyed by the vnode and which part of the file the page holds; the
+ * rest map the same frame. (After fork, parent and child share all
+ * their resident pages anyway.) The cache holds a reference to each
+ * of its frames and to their vnodes, and lets go of a page once no
+ * address space maps it, so it only ever holds the text of programs
+ * that are running.
+ *
+ * Text pages are mapped read-only and never written. Being shared,
+ * they aren't paged out while they are cached.
+ *
+ * Nor may the file be written while any process is running it: the
+ * cache would go on handing out the old text, and a new process would
+ * get that with data read fresh from the new file. (Running processes
+ * page in both lazily, so they'd be no better off.) Writes,
+ * truncation and writable shared mappings of such a file fail with
+ * ETXTBSY instead, as on Unix. The check is made at the time of each
+ * write, so a file already open for writing is covered too; a
+ * writable shared mapping made before the program started is not.
+ *
+ *    textcache_bootstrap - set up; called from vm_bootstrap.
+ *    textcache_istext    - true if the pages of RG should be shared.
+ *    textcache_get       - hand back in *RET the frame holding the
+ *                          page at VADDR of RG, with a reference for
+ *                          AS, reading it in if need be. Returns
+ *                          ENOENT if the page has no file data; it's
+ *                          just zeros, and not worth sharing.
+ *    textcache_attach    - note that a text region (one that
+ *                          textcache_istext is true for) is backed by
+ *                          V. Returns ENOMEM if out of memory.
+ *    textcache_detach    - undo textcache_attach when the region goes
+ *                          away, and drop the cached pages of V that no
+ *                          address space maps any more.
+ *    textcache_busy      - true if V is backing any text region, so
+ *                          mustn't be written.
+ *    textcache_printstats - print the number of pages cached.
+ */
+
+struct addrspace;
+struct region;
+struct vnode;
+
+void textcache_bootstrap(void);
+bool textcache_istext(struct region *rg);
+int textcache_get(struct addrspace *as, struct region *rg, vaddr_t vaddr,
+		  paddr_t *ret);
+int textcache_attach(struct vnode *v);
+void textcache_detach(struct vnode *v);
+bool textcache_busy(struct vnode *v);
+void textcache_printstats(void);
+
+#endif /* _TEXTCACHE_H_ */
@@ -51,8 +51,17 @@ void vm_bootstrap(void);
 /* Fault handling function called by trap code */
 int vm_fault(int faulttype, vaddr_t faultaddress);
 
+/*
+ * Page in the page at VADDR of AS ahead of use, if it isn't resident,
+ * without loading it into the TLB. Fails with ENOMEM rather than
+ * paging anything else out to make room.
+ */
+int vm_prefault(struct addrspace *as, vaddr_t vaddr);
+
 //Get the address to few pages. Finds free pages and returns the address of those pages.
 paddr_t getppages(unsigned long npages);
+//Release pages obtained from getppages.
+void freeppages(paddr_t paddr);
 
 /* Allocate/free kernel heap pages (called by kmalloc/kfree) */
 vaddr_t alloc_kpages(unsigned npages);
@@ -62,4 +71,32 @@ void free_kpages(vaddr_t addr);
 void vm_tlbshootdown_all(void);
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/*
+ * Remove any translation for VADDR in AS from every CPU's TLB, and
+ * wait until that has happened.
+ */
+void vm_tlbshootdown_page(struct addrspace *as, vaddr_t vaddr);
+
+/*
+ * Batched shootdown, for changing many pages of one address space at
+ * once. Pages are collected with vm_tlbbatch_add and removed from the
+ * TLBs with vm_tlbbatch_flush, which sends at most one IPI to each
+ * CPU the address space has translations on. Past TLBSHOOTDOWN_MAX
+ * pages, those CPUs just flush their whole TLB instead. As with
+ * vm_tlbshootdown_page, change the page table entries first, and
+ * don't reuse the frames until the flush has returned.
+ */
+struct tlbbatch {
+	struct addrspace *tb_as;
+	int tb_num;			/* pages, or TLBSHOOTDOWN_ALL */
+	struct tlbshootdown tb_pages[TLBSHOOTDOWN_MAX];
+};
+
+void vm_tlbbatch_init(struct tlbbatch *tb, struct addrspace *as);
+void vm_tlbbatch_add(struct tlbbatch *tb, vaddr_t vaddr);
+void vm_tlbbatch_flush(struct tlbbatch *tb);
+
+/* Print shootdown counts, for the cm menu command. */
+void vm_tlbshootdown_printstats(void);
+
 #endif /* _VM_H_ */
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _VMSTAT_H_
+#define _VMSTAT_H_
+
+/*
+ * VM event counters (see <kern/vmstat.h> for the list).
+ *
+ * Each CPU counts into its own set, so counting takes no locks and
+ * doesn't bounce cache lines around; the sets are only added up when
+ * someone asks.
+ *
+ *    vmstat_inc/vmstat_add - count one/N of event WHICH on this CPU.
+ *    vmstat_getcpu - copy out CPU's counters.
+ *    vmstat_gettotals - copy out the sums over all CPUs.
+ *    vmstat_print - print the totals, for the vm menu command.
+ */
+
+#include <kern/vmstat.h>
+
+void vmstat_inc(unsigned which);
+void vmstat_add(unsigned which, unsigned n);
+void vmstat_getcpu(unsigned cpu, unsigned counts[VS_NCOUNTERS]);
+void vmstat_gettotals(unsigned counts[VS_NCOUNTERS]);
+void vmstat_print(void);
+
+
+#endif /* _VMSTAT_H_ */
@@ -39,6 +39,11 @@
 #include <proc.h>
 #include <vfs.h>
 #include <sfs.h>
+#include <coremap.h>
+#include <vm.h>
+#include <vmstat.h>
+#include <textcache.h>
+#include <kmemcache.h>
 #include <syscall.h>
 #include <test.h>
 #include "opt-synchprobs.h"
@@ -255,6 +260,35 @@ cmd_sync(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Command for showing or setting how many neighbouring pages a TLB
+ * miss also loads.
+ */
+static
+int
+cmd_faultaround(int nargs, char **args)
+{
+	int n;
+
+	if (nargs == 1) {
+		kprintf("fault-around: %u pages\n", vm_faultaround);
+		return 0;
+	}
+	if (nargs != 2) {
+		kprintf("Usage: fa [npages]\n");
+		return EINVAL;
+	}
+
+	n = atoi(args[1]);
+	if (n < 0 || n > FAULTAROUND_MAX) {
+		kprintf("fa: npages must be 0-%d\n", FAULTAROUND_MAX);
+		return EINVAL;
+	}
+	vm_faultaround = n;
+
+	return 0;
+}
+
 /*
  * Command for doing an intentional panic.
  */
@@ -420,6 +454,80 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_kheapprof(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		kheap_profile(true);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		kheap_profile(false);
+	}
+	else {
+		kprintf("Usage: khprof on|off\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_kheaptop(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kheap_profreport(10);
+	}
+	else if (nargs == 2) {
+		kheap_profreport(atoi(args[1]));
+	}
+	else {
+		kprintf("Usage: khtop [count]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_kmemcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kmem_cache_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vmstat_print();
+
+	return 0;
+}
+
+static
+int
+cmd_coremapstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	coremap_printstats();
+	textcache_printstats();
+	asid_printstats();
+	vm_utlb_printstats();
+	vm_tlbshootdown_printstats();
+
+	return 0;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -459,6 +567,7 @@ static const char *opsmenu[] = {
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
+	"[fa]      Set VM fault-around pages ",
 	"[panic]   Intentional panic         ",
 	"[q]       Quit and shut down        ",
 	NULL
@@ -483,6 +592,8 @@ static const char *testmenu[] = {
 	"[km2] kmalloc stress test           ",
 	"[km3] Large kmalloc test            ",
 	"[km4] Multipage kmalloc test        ",
+	"[fab] Fault-around benchmark        ",
+	"[cpb] copyin/copyout benchmark      ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -527,6 +638,11 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[khprof] Kernel heap profiler on/off",
+	"[khtop] Top kernel heap call sites  ",
+	"[kc] Kernel object cache stats      ",
+	"[cm] Physical memory (coremap) stats",
+	"[vm] VM event counters              ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -567,6 +683,7 @@ static struct {
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
+	{ "fa",		cmd_faultaround },
 	{ "panic",	cmd_panic },
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
@@ -582,6 +699,11 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "khprof",     cmd_kheapprof },
+	{ "khtop",      cmd_kheaptop },
+	{ "kc",         cmd_kmemcachestats },
+	{ "cm",         cmd_coremapstats },
+	{ "vm",         cmd_vmstats },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -591,6 +713,8 @@ static struct {
 	{ "km2",	kmallocstress },
 	{ "km3",	kmalloctest3 },
 	{ "km4",	kmalloctest4 },
+	{ "fab",	faultaroundbench },
+	{ "cpb",	copybench },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
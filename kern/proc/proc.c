@@ -51,6 +51,7 @@
 #include <vnode.h>
 #include <synch.h>
 #include <filetable.h>
+#include <kmemcache.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
@@ -59,6 +60,37 @@ struct proc *kproc;
 struct proc *proc_list[PID_MAX];
 struct lock *proc_list_lock;
 
+/*
+ * Cache of proc structures. A free one has its spinlock, its (empty)
+ * thread array and its waitpid CV already set up.
+ */
+static struct kmem_cache *proc_cache;
+
+static
+int
+proc_ctor(void *obj)
+{
+	struct proc *proc = obj;
+
+	proc->cv_waitpid = cv_create("cv_waitpid");
+	if (proc->cv_waitpid == NULL) {
+		return ENOMEM;
+	}
+	threadarray_init(&proc->p_threads);
+	spinlock_init(&proc->p_lock);
+	return 0;
+}
+
+static
+void
+proc_dtor(void *obj)
+{
+	struct proc *proc = obj;
+
+	threadarray_cleanup(&proc->p_threads);
+	spinlock_cleanup(&proc->p_lock);
+	cv_destroy(proc->cv_waitpid);
+}
 
 /*
  * Create a proc structure.
@@ -69,19 +101,16 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kmem_cache_alloc(proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		kmem_cache_free(proc_cache, proc);
 		return NULL;
 	}
 
-	threadarray_init(&proc->p_threads);
-	spinlock_init(&proc->p_lock);
-
 	/* VM fields */
 	proc->p_addrspace = NULL;
 
@@ -100,14 +129,15 @@ proc_create(const char *name)
 		proc->pid=pid;
 		proc_list[pid] = proc;
 	}else{	
+		kfree(proc->p_name);
+		kmem_cache_free(proc_cache, proc);
 		return NULL;
 	}
 	
-	proc->cv_waitpid = cv_create("cv_waitpid");	
-	
 	proc->ppid = 0;
 	proc->exitcode = 0;
 	proc->exitdone = false;
+	proc->p_vforksem = NULL;
 
 	return proc;
 }
@@ -211,11 +241,9 @@ proc_destroy(struct proc *proc)
 		}
 		as_destroy(as);
 	}
-	threadarray_cleanup(&proc->p_threads);
-	spinlock_cleanup(&proc->p_lock);
+	KASSERT(threadarray_num(&proc->p_threads) == 0);
 	kfree(proc->p_name);
-	cv_destroy(proc->cv_waitpid);
-	kfree(proc);
+	kmem_cache_free(proc_cache, proc);
 }
 
 /*
@@ -224,6 +252,12 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+	proc_cache = kmem_cache_create("proc", sizeof(struct proc),
+				       proc_ctor, proc_dtor);
+	if (proc_cache == NULL) {
+		panic("proc_bootstrap: Could not create proc cache\n");
+	}
+
 	proclist_init();
 
 	kproc = proc_create("[kernel]");
@@ -19,6 +19,7 @@
 #include <vfs.h>
 #include <openfile.h>
 #include <kern/fcntl.h>
+#include <kern/limits.h>
 #include <test.h>
 #include <filetable.h>
 
@@ -30,6 +31,7 @@ static void thread_init(void * tf,unsigned long data2){
 	as_activate();
 
 	temp_tf = *(struct trapframe *)tf;
+	kfree(tf);
 	enter_forked_process(&temp_tf);
 } 
 
@@ -76,6 +78,76 @@ sys_fork(struct trapframe *tf,pid_t *pid)
 	return 0;
 }
 
+/*
+ * Like fork, but the child runs in our address space instead of a
+ * copy of it, and we wait until it has exec'd or exited and so is
+ * done with it. For launching programs, where copying the address
+ * space only to throw it away at once is a waste.
+ */
+int
+sys_vfork(struct trapframe *tf, pid_t *pid)
+{
+	struct proc *child;
+	struct trapframe *child_tf;
+	struct semaphore *sem;
+	int err;
+
+	sem = sem_create("vfork", 0);
+	if (sem == NULL) {
+		return ENOMEM;
+	}
+
+	err = proc_fork(&child);
+	if (err) {
+		sem_destroy(sem);
+		return err;
+	}
+
+	child_tf = kmalloc(sizeof(struct trapframe));
+	if (child_tf == NULL) {
+		proc_destroy(child);
+		sem_destroy(sem);
+		return ENOMEM;
+	}
+	*child_tf = *tf;
+
+	child->p_addrspace = curproc->p_addrspace;
+	child->p_vforksem = sem;
+	child->ppid = curproc->pid;
+
+	err = thread_fork("vforked_child", child, thread_init, child_tf,
+			  (unsigned long)child->p_addrspace);
+	if (err) {
+		/* Not the child's to destroy. */
+		child->p_addrspace = NULL;
+		proc_destroy(child);
+		kfree(child_tf);
+		sem_destroy(sem);
+		return err;
+	}
+
+	*pid = child->pid;
+	P(sem);
+	sem_destroy(sem);
+	return 0;
+}
+
+/*
+ * Called by a vforked child once it no longer uses its parent's
+ * address space, to let the parent run again.
+ */
+static
+void
+vfork_release(void)
+{
+	struct semaphore *sem;
+
+	sem = curproc->p_vforksem;
+	KASSERT(sem != NULL);
+	curproc->p_vforksem = NULL;
+	V(sem);
+}
+
 /*
  * Method called by a process when it wants to wait on its child. The child is specified by the pid argument passed to this method.
  */
@@ -129,6 +201,23 @@ sys_waitpid(pid_t pid, int *returncode, int flags, pid_t *retval)
 void
 sys__exit(int exitcode)
 {
+	proc_exit(_MKWAIT_EXIT(exitcode));
+}
+
+/*
+ * Common exit path for _exit() and for processes killed by a fatal
+ * trap. STATUS is an already-encoded wait status.
+ */
+void
+proc_exit(int status)
+{
+	if (curproc->p_vforksem != NULL) {
+		/* The address space is our parent's; leave it alone. */
+		proc_setas(NULL);
+		as_deactivate();
+		vfork_release();
+	}
+
 	lock_acquire(proc_list_lock);
 
 	for (int i =0; i < PID_MAX; i++){
@@ -142,7 +231,7 @@ sys__exit(int exitcode)
 		
 	spinlock_acquire(&curproc->p_lock);
 	curproc->exitdone = true;
-	curproc->exitcode = _MKWAIT_EXIT(exitcode);		
+	curproc->exitcode = status;
 	cv_signal(curproc->cv_waitpid, proc_list_lock);
 	spinlock_release(&curproc->p_lock);
 	lock_release(proc_list_lock);
@@ -150,151 +239,346 @@ sys__exit(int exitcode)
 	thread_exit();
 }
 
-int 
-sys_execv(char *program,char **args){
-//	(void) args;
+/*
+ * Argument buffer for execv.
+ *
+ * The argument strings are copied in packed end to end, each with its
+ * terminator, into a single buffer that starts at a page and doubles
+ * as needed. What the new program will see - the strings plus one
+ * pointer per argument and the terminating NULL - is held to ARG_MAX
+ * in total, so the cost of an exec follows the size of its arguments
+ * rather than their number.
+ */
+struct argbuf {
+	char *ab_buf;		/* packed strings */
+	size_t ab_size;		/* bytes allocated */
+	size_t ab_len;		/* bytes used */
+	size_t ab_argc;		/* number of strings */
+};
+
+/* Number of argv pointers to move per copyin/copyout. */
+#define ARGBUF_NPTRS	32
+
+static
+void
+argbuf_init(struct argbuf *ab)
+{
+	ab->ab_buf = NULL;
+	ab->ab_size = 0;
+	ab->ab_len = 0;
+	ab->ab_argc = 0;
+}
+
+static
+void
+argbuf_cleanup(struct argbuf *ab)
+{
+	kfree(ab->ab_buf);
+	argbuf_init(ab);
+}
+
+/*
+ * Make the buffer bigger, up to ARG_MAX. Returns E2BIG if it is
+ * already that big.
+ */
+static
+int
+argbuf_grow(struct argbuf *ab)
+{
+	size_t newsize;
+	char *newbuf;
+
+	if (ab->ab_size >= ARG_MAX) {
+		return E2BIG;
+	}
+	newsize = ab->ab_size == 0 ? PAGE_SIZE : ab->ab_size * 2;
+	if (newsize > ARG_MAX) {
+		newsize = ARG_MAX;
+	}
+
+	newbuf = kmalloc(newsize);
+	if (newbuf == NULL) {
+		return ENOMEM;
+	}
+	if (ab->ab_len > 0) {
+		memcpy(newbuf, ab->ab_buf, ab->ab_len);
+	}
+	kfree(ab->ab_buf);
+	ab->ab_buf = newbuf;
+	ab->ab_size = newsize;
+	return 0;
+}
+
+/*
+ * Copy in one argument string at the end of the buffer.
+ */
+static
+int
+argbuf_addstr(struct argbuf *ab, const_userptr_t ustr)
+{
+	size_t space, limit, got;
+	int result;
+
+	/* room left under ARG_MAX for this string and its pointer */
+	if (ab->ab_len + (ab->ab_argc + 2) * sizeof(userptr_t) >= ARG_MAX) {
+		return E2BIG;
+	}
+	limit = ARG_MAX - ab->ab_len - (ab->ab_argc + 2) * sizeof(userptr_t);
+
+	while (1) {
+		space = ab->ab_size - ab->ab_len;
+		if (space > limit) {
+			space = limit;
+		}
+
+		result = copyinstr(ustr, ab->ab_buf + ab->ab_len, space, &got);
+		if (result == 0) {
+			break;
+		}
+		if (result != ENAMETOOLONG) {
+			return result;
+		}
+		if (space == limit) {
+			return E2BIG;
+		}
+		result = argbuf_grow(ab);
+		if (result) {
+			return result;
+		}
+	}
+
+	ab->ab_len += got;
+	ab->ab_argc++;
+	return 0;
+}
+
+/*
+ * Copy in the argv vector UARGV and the strings it points to.
+ *
+ * The pointers are fetched several at a time, but never past the end
+ * of the page the next one is on: the vector ends with NULL, and
+ * the page after it need not be mapped.
+ */
+static
+int
+argbuf_copyin(struct argbuf *ab, userptr_t uargv)
+{
+	userptr_t ptrs[ARGBUF_NPTRS];
+	vaddr_t uaddr;
+	size_t n, i;
+	int result;
+
+	result = argbuf_grow(ab);
+	if (result) {
+		return result;
+	}
+
+	uaddr = (vaddr_t)uargv;
+	if (uaddr % sizeof(userptr_t) != 0) {
+		return EFAULT;
+	}
+	while (1) {
+		n = (PAGE_SIZE - uaddr % PAGE_SIZE) / sizeof(userptr_t);
+		if (n > ARGBUF_NPTRS) {
+			n = ARGBUF_NPTRS;
+		}
+		result = copyin((const_userptr_t)uaddr, ptrs,
+				n * sizeof(userptr_t));
+		if (result) {
+			return result;
+		}
+		for (i=0; i<n; i++) {
+			if (ptrs[i] == NULL) {
+				return 0;
+			}
+			result = argbuf_addstr(ab, ptrs[i]);
+			if (result) {
+				return result;
+			}
+		}
+		uaddr += n * sizeof(userptr_t);
+	}
+}
+
+/*
+ * Lay the arguments out at the top of the new program's stack: the
+ * strings, as packed, with the argv vector below them. Moves *STACKPTR
+ * down past both (keeping it 8-byte aligned) and returns the user
+ * address of argv in *UARGV.
+ */
+static
+int
+argbuf_copyout(const struct argbuf *ab, vaddr_t *stackptr, userptr_t *uargv)
+{
+	userptr_t ptrs[ARGBUF_NPTRS];
+	vaddr_t strbase, argvbase;
+	size_t pos, i, n;
+	int result;
+
+	strbase = *stackptr - ROUNDUP(ab->ab_len, 8);
+	argvbase = strbase - ROUNDUP((ab->ab_argc + 1) * sizeof(userptr_t), 8);
+
+	result = copyout(ab->ab_buf, (userptr_t)strbase, ab->ab_len);
+	if (result) {
+		return result;
+	}
+
+	pos = 0;
+	n = 0;
+	for (i=0; i<=ab->ab_argc; i++) {
+		if (i < ab->ab_argc) {
+			ptrs[n++] = (userptr_t)(strbase + pos);
+			pos += strlen(ab->ab_buf + pos) + 1;
+		}
+		else {
+			ptrs[n++] = NULL;
+		}
+		if (n == ARGBUF_NPTRS || i == ab->ab_argc) {
+			result = copyout(ptrs, (userptr_t)(argvbase +
+				(i + 1 - n) * sizeof(userptr_t)),
+				n * sizeof(userptr_t));
+			if (result) {
+				return result;
+			}
+			n = 0;
+		}
+	}
+	KASSERT(pos == ab->ab_len);
 
-//	kprintf("\nexecv is STARTING. \n");
+	*stackptr = argvbase;
+	*uargv = (userptr_t)argvbase;
+	return 0;
+}
+
+/*
+ * Go back to OLDAS after execv fails partway, throwing away the new
+ * address space.
+ */
+static
+int
+execv_fail(struct addrspace *oldas, int result)
+{
 	struct addrspace *as;
-        struct vnode *v;
-        vaddr_t entrypoint, stackptr;
+
+	as = proc_setas(oldas);
+	as_activate();
+	as_destroy(as);
+	return result;
+}
+
+int 
+sys_execv(char *program,char **args){
+	struct addrspace *as, *oldas;
+	struct vnode *v;
+	vaddr_t entrypoint, stackptr;
+	userptr_t uargv;
+	struct argbuf ab;
+	char *kpath;
+	size_t argc;
 	int result;
-	
-	//Checking if arguments exist. If so, then set it to true.
-	bool argument = (args != NULL);
-  	
-	size_t argc = 0;
- 	
-	//Count the total number of arguments and track it using argc
-	if(argument){
-    	    while(true){
-      		char *argtemp = NULL;
-      		copyin((const_userptr_t)args[argc], &argtemp, sizeof(char*));
-      
-     		 if(argtemp != NULL){
-        //		kprintf("\nEXECV TEST : CHECKING ARGUMENT -> %d - %s\n",argc,args[argc]);
-			argc++;
-      		}
-      		else{
-        		break;
-      		}
-    	    }
-  	}	
-	
-	//Create pointer to store arguments and copy them into kernel space
-	char **kern_args = kmalloc(sizeof(char *) * (argc+1));
-  	if(kern_args == NULL){
-    		return ENOMEM;
- 	}
-	
-	for(size_t i = 0; i < argc; i++){
- 	   	kern_args[i] = kmalloc(ARG_MAX);
-    		char *argtemp;
-    		argtemp = kern_args[i];
-    		size_t arg_len;
-    		
-		result = copyinstr((const_userptr_t)args[i], kern_args[i], ARG_MAX, &arg_len);
-    		if(result) {
-      		return result;
-    		}
-  	}
-//	kprintf("EXECV TEST : CHECKING ARGUMENT -> 0 - %s",(char *) kern_args[0]);
- 	//setting NULL terminate in the pointer 
-  	kern_args[argc] = NULL;
-
-	/*Destroy address space of current process, so we can create one for the new program.*/
-	as_destroy(curproc->p_addrspace);
-        curproc->p_addrspace = NULL;
-	
-	result = vfs_open(program, O_RDONLY, 0, &v);
-        if (result) {
-                return result;
-        }
-	
-	KASSERT(proc_getas() == NULL);
+
+	/*
+	 * Get the pathname. vfs_open scribbles on it, and a vforked
+	 * child's user memory is its parent's, so it must be a copy.
+	 */
+	kpath = kmalloc(PATH_MAX);
+	if (kpath == NULL) {
+		return ENOMEM;
+	}
+	result = copyinstr((const_userptr_t)program, kpath, PATH_MAX, NULL);
+	if (result) {
+		kfree(kpath);
+		return result;
+	}
+
+	/* Copy the arguments in before the old image goes away. */
+	argbuf_init(&ab);
+	if (args != NULL) {
+		result = argbuf_copyin(&ab, (userptr_t)args);
+		if (result) {
+			argbuf_cleanup(&ab);
+			kfree(kpath);
+			return result;
+		}
+	}
+
+	result = vfs_open(kpath, O_RDONLY, 0, &v);
+	kfree(kpath);
+	if (result) {
+		argbuf_cleanup(&ab);
+		return result;
+	}
 
 	if (curproc->p_filetable == NULL) {
-                curproc->p_filetable = filetable_create();
-                if (curproc->p_filetable == NULL) {
-                        vfs_close(v);
-                        return ENOMEM;
-                }
-
-                result = open_stdfds("con:", "con:", "con:");
-                if (result) {
-                        vfs_close(v);
-                        return result;
-                }
-      	}
+		curproc->p_filetable = filetable_create();
+		if (curproc->p_filetable == NULL) {
+			vfs_close(v);
+			argbuf_cleanup(&ab);
+			return ENOMEM;
+		}
 
+		result = open_stdfds("con:", "con:", "con:");
+		if (result) {
+			vfs_close(v);
+			argbuf_cleanup(&ab);
+			return result;
+		}
+	}
+
+	/*
+	 * Load the new program into a fresh address space, keeping the
+	 * old one until we know it has worked. (A vforked child's old
+	 * address space is its parent's.)
+	 */
 	as = as_create();
-        if (as == NULL) {
-                vfs_close(v);
-                return ENOMEM;
-        }	
+	if (as == NULL) {
+		vfs_close(v);
+		argbuf_cleanup(&ab);
+		return ENOMEM;
+	}
 
-	proc_setas(as);
-        as_activate();
+	oldas = proc_setas(as);
+	as_activate();
 
 	result = load_elf(v, &entrypoint);
-        if (result) {
-	        vfs_close(v);
-                return result;
-        }	
+	if (result) {
+		vfs_close(v);
+		argbuf_cleanup(&ab);
+		return execv_fail(oldas, result);
+	}
 
 	vfs_close(v);
 
 	result = as_define_stack(as, &stackptr);
-        if (result) {
-		return result;
+	if (result) {
+		argbuf_cleanup(&ab);
+		return execv_fail(oldas, result);
 	}
 
-	
-	vaddr_t args_stk_addr[argc];
-  	/* Need to NULL terminate */
-  	args_stk_addr[argc] = 0;
-	
-	/* Copy argument strings first, do not copy NULL one */
-  	for(int i = (int)argc-1; i >= 0; i--){
-    		size_t arg_len=strlen(kern_args[i])+1;
-    		/* When storing items on the stack, pad each item such that 
- 	 	*they are 8-byte aligned
- 	 	**/
-    		stackptr -= ROUNDUP(arg_len,8);
-    		copyoutstr(kern_args[i], (userptr_t)stackptr, ARG_MAX, &arg_len);
-    
-    		if(result) {
-      			return result;
-    		}
-    		args_stk_addr[i] = stackptr;
-  	}
-
-	/* Copy argument pointers */
-	for (int i = (int)argc; i >= 0; i--){
- 		stackptr -= sizeof(vaddr_t);
-    		result = copyout(&args_stk_addr[i], (userptr_t)stackptr, sizeof(vaddr_t));
-    		if(result) {
-      			return result;
-    		}
-  	}
-  	vaddr_t userspace_addr = 0;
-  	if(argument){
-    		userspace_addr = stackptr;
-  	}
-
-	for(size_t i = 0; i < argc; i++){
-    		kfree(kern_args[i]);
-    		kern_args[i] = NULL;
-  	}
- 	kfree(kern_args);
-  	kern_args = NULL;
-	
-//	kprintf("EXECV TEST : CHECKING ARGUMENT -> 0 - %s",userspace_addr[0]);
-	
-	enter_new_process(argc /*argc*/, (userptr_t) userspace_addr /*userspace addr of argv*/,
-                          NULL /*userspace addr of environment*/,
-                          stackptr, entrypoint);
+	uargv = NULL;
+	if (args != NULL) {
+		result = argbuf_copyout(&ab, &stackptr, &uargv);
+		if (result) {
+			argbuf_cleanup(&ab);
+			return execv_fail(oldas, result);
+		}
+	}
+
+	argc = ab.ab_argc;
+	argbuf_cleanup(&ab);
+
+	/* No going back now. */
+	if (curproc->p_vforksem != NULL) {
+		vfork_release();
+	}
+	else if (oldas != NULL) {
+		as_destroy(oldas);
+	}
+
+	enter_new_process(argc /*argc*/, uargv /*userspace addr of argv*/,
+			  NULL /*userspace addr of environment*/,
+			  stackptr, entrypoint);
 
 	panic("enter_new_process returned\n");
-        return EINVAL;
+	return EINVAL;
 }
@@ -47,6 +47,8 @@
 #include <vnode.h>
 #include <openfile.h>
 #include <filetable.h>
+#include <addrspace.h>
+#include <textcache.h>
 #include <syscall.h>
 
 /*
@@ -142,6 +144,12 @@ sys_readwrite(int fd, userptr_t buf, size_t size, enum uio_rw rw,
 		goto fail;
 	}
 
+	/* Don't change a program out from under its running text. */
+	if (rw == UIO_WRITE && textcache_busy(file->of_vnode)) {
+		result = ETXTBSY;
+		goto fail;
+	}
+
 	/* set up a uio with the buffer, its size, and the current offset */
 	uio_uinit(&iov, &useruio, buf, size, pos, rw);
 
@@ -288,6 +296,34 @@ sys_lseek(int fd, off_t offset, int whence, off_t *retval)
 	return 0;
 }
 
+/*
+ * fsync() - flush a file to disk, including any changes made through
+ * MAP_SHARED mappings of it in this process.
+ */
+int
+sys_fsync(int fd)
+{
+	struct openfile *file;
+	struct addrspace *as;
+	int result;
+
+	result = filetable_get(curproc->p_filetable, fd, &file);
+	if (result) {
+		return result;
+	}
+
+	as = proc_getas();
+	if (as != NULL) {
+		result = as_msync_vnode(as, file->of_vnode);
+	}
+	if (result == 0) {
+		result = VOP_FSYNC(file->of_vnode);
+	}
+
+	filetable_put(curproc->p_filetable, fd, file);
+	return result;
+}
+
 /*
  * dup2() - clone a file descriptor.
  */
@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Memory management system calls.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <proc.h>
+#include <current.h>
+#include <vnode.h>
+#include <openfile.h>
+#include <filetable.h>
+#include <addrspace.h>
+#include <textcache.h>
+#include <syscall.h>
+#include <vmstat.h>
+
+/*
+ * sbrk: move the break, returning the old one.
+ */
+int
+sys_sbrk(intptr_t amount, int *retval)
+{
+	struct addrspace *as;
+	vaddr_t oldbreak;
+	int result;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	result = as_sbrk(as, amount, &oldbreak);
+	if (result) {
+		return result;
+	}
+
+	*retval = (int)oldbreak;
+	return 0;
+}
+
+/*
+ * mmap: map part of an open file. We always choose the address; ADDR
+ * is only a hint and is ignored.
+ */
+int
+sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+	 off_t offset, int *retval)
+{
+	struct addrspace *as;
+	struct openfile *file;
+	struct stat info;
+	vaddr_t vaddr;
+	int result;
+
+	(void)addr;
+
+	if (len == 0 || offset < 0 || offset % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	if (flags != MAP_SHARED && flags != MAP_PRIVATE) {
+		return EINVAL;
+	}
+	if ((prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0) {
+		return EINVAL;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	result = filetable_get(curproc->p_filetable, fd, &file);
+	if (result) {
+		return result;
+	}
+
+	/* Reading the file must be allowed; so must writing, if shared. */
+	if (file->of_accmode == O_WRONLY ||
+	    (flags == MAP_SHARED && (prot & PROT_WRITE) &&
+	     file->of_accmode == O_RDONLY)) {
+		filetable_put(curproc->p_filetable, fd, file);
+		return EACCES;
+	}
+
+	/* Writing a running program isn't allowed; see textcache.h */
+	if (flags == MAP_SHARED && (prot & PROT_WRITE) &&
+	    textcache_busy(file->of_vnode)) {
+		filetable_put(curproc->p_filetable, fd, file);
+		return ETXTBSY;
+	}
+
+	result = VOP_MMAP(file->of_vnode, prot);
+	if (result) {
+		filetable_put(curproc->p_filetable, fd, file);
+		return result;
+	}
+
+	result = VOP_STAT(file->of_vnode, &info);
+	if (result) {
+		filetable_put(curproc->p_filetable, fd, file);
+		return result;
+	}
+
+	result = as_mmap(as, len, prot, flags, file->of_vnode, offset,
+			 info.st_size, &vaddr);
+	filetable_put(curproc->p_filetable, fd, file);
+	if (result) {
+		return result;
+	}
+
+	*retval = (int)vaddr;
+	return 0;
+}
+
+/*
+ * munmap: remove mappings made with mmap.
+ */
+int
+sys_munmap(userptr_t addr, size_t len)
+{
+	struct addrspace *as;
+	vaddr_t vaddr = (vaddr_t)addr;
+
+	if ((vaddr & PAGE_FRAME) != vaddr || len == 0) {
+		return EINVAL;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	return as_munmap(as, vaddr, len);
+}
+
+/*
+ * madvise: tell the VM system how the pages in [ADDR, ADDR+LEN) will
+ * be used. See as_madvise.
+ */
+int
+sys_madvise(userptr_t addr, size_t len, int advice)
+{
+	struct addrspace *as;
+	vaddr_t vaddr = (vaddr_t)addr;
+
+	if ((vaddr & PAGE_FRAME) != vaddr) {
+		return EINVAL;
+	}
+	if (advice < MADV_NORMAL || advice > MADV_FREE) {
+		return EINVAL;
+	}
+	if (len == 0) {
+		return 0;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	return as_madvise(as, vaddr, len, advice);
+}
+
+/*
+ * mincore: report in VEC, one byte per page, which pages of
+ * [ADDR, ADDR+LEN) are resident. Done a chunk at a time.
+ */
+#define MINCORE_CHUNK	256
+
+int
+sys_mincore(userptr_t addr, size_t len, userptr_t vec)
+{
+	unsigned char buf[MINCORE_CHUNK];
+	struct addrspace *as;
+	vaddr_t vaddr = (vaddr_t)addr;
+	size_t npages, n;
+	int result;
+
+	if ((vaddr & PAGE_FRAME) != vaddr) {
+		return EINVAL;
+	}
+	if (len > USERSPACETOP - vaddr) {
+		return ENOMEM;
+	}
+	npages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+
+	while (npages > 0) {
+		n = npages < MINCORE_CHUNK ? npages : MINCORE_CHUNK;
+		result = as_mincore(as, vaddr, n, buf);
+		if (result) {
+			return result;
+		}
+		result = copyout(buf, vec, n);
+		if (result) {
+			return result;
+		}
+		vaddr += n * PAGE_SIZE;
+		vec += n;
+		npages -= n;
+	}
+	return 0;
+}
+
+/*
+ * __vmstat: copy out up to NCOUNTERS of the system-wide VM event
+ * counters, indexed as in <kern/vmstat.h>. Returns how many counters
+ * the kernel keeps, so callers built against a different list can
+ * tell.
+ */
+int
+sys___vmstat(userptr_t counts, unsigned ncounts, int *retval)
+{
+	unsigned totals[VS_NCOUNTERS];
+	int result;
+
+	if (ncounts > VS_NCOUNTERS) {
+		ncounts = VS_NCOUNTERS;
+	}
+
+	vmstat_gettotals(totals);
+	result = copyout(totals, counts, ncounts * sizeof(totals[0]));
+	if (result) {
+		return result;
+	}
+
+	*retval = VS_NCOUNTERS;
+	return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * copyin/copyout benchmark.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <vm.h>
+#include <test.h>
+
+/*
+ * Time copyin, copyout and copyinstr for a range of transfer sizes,
+ * with memcpy between two kernel buffers as a baseline, and report
+ * the throughput of each. Each size moves the same total number of
+ * bytes, so small sizes show the fixed per-call cost (copycheck and
+ * the setjmp) and large sizes the per-byte cost. The "unaligned"
+ * column copies in from one byte past a word boundary, so the two
+ * pointers never line up and the byte loop is used throughout.
+ *
+ * Like the fault-around benchmark this borrows the kernel process
+ * for a user address space. The user buffer is touched before
+ * timing starts so no page faults are counted.
+ */
+
+#define CPB_BASE	0x10000000
+#define CPB_MAXSIZE	4096
+#define CPB_BUFSIZE	(CPB_MAXSIZE + sizeof(unsigned long))
+#define CPB_TOTAL	(1024*1024)
+
+static const size_t cpb_sizes[] = { 8, 32, 128, 512, 1024, 4096 };
+
+enum cpb_op {
+	CPB_MEMCPY,
+	CPB_COPYIN,
+	CPB_COPYIN_UNALIGNED,
+	CPB_COPYOUT,
+	CPB_COPYINSTR,
+	CPB_NOPS,
+};
+
+/*
+ * Throughput in hundredths of a byte per microsecond (i.e. MB/s *
+ * 100), kept in 32 bits; CPB_TOTAL*100 fits comfortably.
+ */
+static
+unsigned
+cpb_rate(size_t bytes, const struct timespec *ts)
+{
+	unsigned usec;
+
+	usec = ts->tv_sec * 1000000 + ts->tv_nsec / 1000;
+	if (usec == 0) {
+		usec = 1;
+	}
+	return bytes * 100 / usec;
+}
+
+static
+int
+cpb_run(enum cpb_op op, size_t size, char *kbuf, char *kbuf2,
+	unsigned *rate)
+{
+	userptr_t ubuf = (userptr_t)CPB_BASE;
+	struct timespec ts1, ts2;
+	unsigned i, iters;
+	size_t got;
+	int result = 0;
+
+	iters = CPB_TOTAL / size;
+
+	gettime(&ts1);
+	for (i=0; i<iters && result == 0; i++) {
+		switch (op) {
+		    case CPB_MEMCPY:
+			memcpy(kbuf2, kbuf, size);
+			break;
+		    case CPB_COPYIN:
+			result = copyin(ubuf, kbuf, size);
+			break;
+		    case CPB_COPYIN_UNALIGNED:
+			result = copyin((userptr_t)(CPB_BASE + 1), kbuf, size);
+			break;
+		    case CPB_COPYOUT:
+			result = copyout(kbuf, ubuf, size);
+			break;
+		    case CPB_COPYINSTR:
+			result = copyinstr(ubuf, kbuf, CPB_BUFSIZE, &got);
+			if (result == 0 && got != size) {
+				result = EINVAL;
+			}
+			break;
+		    default:
+			panic("copybench: bad op %d\n", op);
+		}
+	}
+	gettime(&ts2);
+
+	if (result) {
+		return result;
+	}
+	timespec_sub(&ts2, &ts1, &ts2);
+	*rate = cpb_rate(iters * size, &ts2);
+	return 0;
+}
+
+int
+copybench(int nargs, char **args)
+{
+	struct addrspace *as, *oldas;
+	char *kbuf, *kbuf2, *ustr;
+	unsigned rates[CPB_NOPS];
+	unsigned i, j;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kbuf = kmalloc(CPB_BUFSIZE);
+	kbuf2 = kmalloc(CPB_BUFSIZE);
+	if (kbuf == NULL || kbuf2 == NULL) {
+		kfree(kbuf);
+		kfree(kbuf2);
+		return ENOMEM;
+	}
+	memset(kbuf, 'k', CPB_BUFSIZE);
+
+	as = as_create();
+	if (as == NULL) {
+		kfree(kbuf);
+		kfree(kbuf2);
+		return ENOMEM;
+	}
+	result = as_define_region(as, CPB_BASE,
+				  ROUNDUP(CPB_BUFSIZE, PAGE_SIZE), 1, 1, 0);
+	if (result) {
+		as_destroy(as);
+		kfree(kbuf);
+		kfree(kbuf2);
+		return result;
+	}
+
+	oldas = proc_setas(as);
+	as_activate();
+
+	/* Fault in and fill the user buffer. */
+	ustr = (char *)CPB_BASE;
+	memset(ustr, 'u', CPB_BUFSIZE);
+
+	kprintf("MB/s by transfer size (%u bytes per test)\n", CPB_TOTAL);
+	kprintf("%6s %9s %9s %9s %9s %9s\n", "size", "memcpy", "copyin",
+		"unaligned", "copyout", "copyinstr");
+	for (i=0; i<sizeof(cpb_sizes)/sizeof(cpb_sizes[0]); i++) {
+		/* copyinstr should find a string of exactly this size. */
+		ustr[cpb_sizes[i] - 1] = 0;
+
+		for (j=0; j<CPB_NOPS; j++) {
+			result = cpb_run(j, cpb_sizes[i], kbuf, kbuf2,
+					 &rates[j]);
+			if (result) {
+				kprintf("copybench: size %u: %s\n",
+					cpb_sizes[i], strerror(result));
+				goto done;
+			}
+		}
+
+		ustr[cpb_sizes[i] - 1] = 'u';
+
+		kprintf("%6u", cpb_sizes[i]);
+		for (j=0; j<CPB_NOPS; j++) {
+			kprintf(" %5u.%02u", rates[j] / 100, rates[j] % 100);
+		}
+		kprintf("\n");
+	}
+
+ done:
+	proc_setas(oldas);
+	as_activate();
+	as_destroy(as);
+	kfree(kbuf);
+	kfree(kbuf2);
+
+	if (result == 0) {
+		kprintf("copyin/copyout benchmark done.\n");
+	}
+	return result;
+}
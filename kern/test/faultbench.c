@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Fault-around benchmark.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <vmstat.h>
+#include <test.h>
+
+/*
+ * Walk a region of resident pages sequentially, reading one word from
+ * each page, with fault-around set to each of FAB_WINDOWS in turn, and
+ * report how many TLB misses it takes and how long. The region is
+ * bigger than the TLB, and the TLB is flushed before each pass, so
+ * without fault-around every page misses once per pass.
+ *
+ * This runs in the menu thread, borrowing the kernel process for a
+ * user address space; the kernel reaches the region's pages the same
+ * way a user program would.
+ */
+
+#define FAB_BASE	0x10000000
+#define FAB_NPAGES	256
+#define FAB_NPASSES	8
+
+static const unsigned fab_windows[] = { 0, 1, 3, 7, 15 };
+
+static
+unsigned
+fab_nfast(void)
+{
+	unsigned i, n;
+
+	n = 0;
+	for (i=0; i<MAXCPUS; i++) {
+		n += mips_utlb_nfast[i];
+	}
+	return n;
+}
+
+static
+void
+fab_walk(void)
+{
+	volatile int *p;
+	unsigned i;
+
+	for (i=0; i<FAB_NPAGES; i++) {
+		p = (volatile int *)(FAB_BASE + i * PAGE_SIZE);
+		(void)*p;
+	}
+}
+
+int
+faultaroundbench(int nargs, char **args)
+{
+	struct addrspace *as, *oldas;
+	unsigned before[VS_NCOUNTERS], after[VS_NCOUNTERS];
+	unsigned saved, nfast, nslow, i, j;
+	struct timespec ts1, ts2;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	as = as_create();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	result = as_define_region(as, FAB_BASE, FAB_NPAGES * PAGE_SIZE,
+				  1, 1, 0);
+	if (result) {
+		as_destroy(as);
+		return result;
+	}
+
+	oldas = proc_setas(as);
+	as_activate();
+	saved = vm_faultaround;
+
+	/* Make every page resident (and dirty, so no write faults). */
+	vm_faultaround = 0;
+	for (i=0; i<FAB_NPAGES; i++) {
+		*(volatile int *)(FAB_BASE + i * PAGE_SIZE) = i;
+	}
+
+	kprintf("%u pages, %u passes\n", FAB_NPAGES, FAB_NPASSES);
+	for (j=0; j<sizeof(fab_windows)/sizeof(fab_windows[0]); j++) {
+		vm_faultaround = fab_windows[j];
+
+		vmstat_gettotals(before);
+		nfast = fab_nfast();
+		gettime(&ts1);
+		for (i=0; i<FAB_NPASSES; i++) {
+			vm_tlbshootdown_all();
+			fab_walk();
+		}
+		gettime(&ts2);
+		nfast = fab_nfast() - nfast;
+		vmstat_gettotals(after);
+
+		timespec_sub(&ts2, &ts1, &ts2);
+		nslow = after[VS_FAULTS] - before[VS_FAULTS];
+		kprintf("fault-around %2u: %6u misses (%u fast refills, "
+			"%u vm_faults), %u pages preloaded, "
+			"%llu.%09lu seconds\n",
+			fab_windows[j], nfast + nslow, nfast, nslow,
+			after[VS_FAULTAROUND] - before[VS_FAULTAROUND],
+			(unsigned long long) ts2.tv_sec,
+			(unsigned long) ts2.tv_nsec);
+	}
+
+	vm_faultaround = saved;
+	proc_setas(oldas);
+	as_activate();
+	as_destroy(as);
+
+	kprintf("Fault-around benchmark done.\n");
+	return 0;
+}
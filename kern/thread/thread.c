@@ -46,10 +46,13 @@
 #include <threadprivate.h>
 #include <proc.h>
 #include <current.h>
+#include <platform/maxcpus.h>
 #include <synch.h>
 #include <addrspace.h>
+#include <coremap.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <kmemcache.h>
 
 #include "opt-synchprobs.h"
 
@@ -117,6 +120,34 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Cache of thread structures. A free one has its list node set up and
+ * no stack; stacks are allocated in thread_fork and freed in
+ * thread_destroy, so idle ones don't pile up in the cache.
+ */
+static struct kmem_cache *thread_cache;
+
+static
+int
+thread_ctor(void *obj)
+{
+	struct thread *thread = obj;
+
+	threadlistnode_init(&thread->t_listnode, thread);
+	thread->t_stack = NULL;
+	return 0;
+}
+
+static
+void
+thread_dtor(void *obj)
+{
+	struct thread *thread = obj;
+
+	KASSERT(thread->t_stack == NULL);
+	threadlistnode_cleanup(&thread->t_listnode);
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -129,14 +160,14 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	thread = kmem_cache_alloc(thread_cache);
 	if (thread == NULL) {
 		return NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
+		kmem_cache_free(thread_cache, thread);
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -144,7 +175,7 @@ thread_create(const char *name)
 
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
-	threadlistnode_init(&thread->t_listnode, thread);
+	/* t_listnode comes from the cache */
 	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
@@ -197,6 +228,8 @@ cpu_create(unsigned hardware_number)
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdown_queued = 0;
+	c->c_shootdown_done = 0;
 	spinlock_init(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
@@ -222,6 +255,7 @@ cpu_create(unsigned hardware_number)
 		 * make it possible to free the boot stack?)
 		 */
 		/*c->c_curthread->t_stack = ... */
+		KASSERT(c->c_curthread->t_stack == NULL);
 	}
 	else {
 		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
@@ -261,15 +295,17 @@ thread_destroy(struct thread *thread)
 	KASSERT(thread->t_proc == NULL);
 	if (thread->t_stack != NULL) {
 		kfree(thread->t_stack);
+		thread->t_stack = NULL;
 	}
-	threadlistnode_cleanup(&thread->t_listnode);
+	KASSERT(thread->t_listnode.tln_next == NULL);
+	KASSERT(thread->t_listnode.tln_prev == NULL);
 	thread_machdep_cleanup(&thread->t_machdep);
 
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
-	kfree(thread);
+	kmem_cache_free(thread_cache, thread);
 }
 
 /*
@@ -361,6 +397,12 @@ thread_bootstrap(void)
 
 	cpuarray_init(&allcpus);
 
+	thread_cache = kmem_cache_create("thread", sizeof(struct thread),
+					 thread_ctor, thread_dtor);
+	if (thread_cache == NULL) {
+		panic("thread_bootstrap: Could not create thread cache\n");
+	}
+
 	/*
 	 * Create the cpu structure for the bootup CPU, the one we're
 	 * currently running on. Assume the hardware number is 0; that
@@ -569,6 +611,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 {
 	struct thread *cur, *next;
 	int spl;
+	bool zeroed;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
 	DEBUGASSERT(curthread->t_cpu == curcpu->c_self);
@@ -628,7 +671,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	cur->t_state = newstate;
 
 	/*
-	 * Get the next thread. While there isn't one, call md_idle().
+	 * Get the next thread. While there isn't one, zero pages for
+	 * the VM system's pool, and once that's full, call md_idle().
 	 * curcpu->c_isidle must be true when md_idle is
 	 * called. Unlock the runqueue while idling too, to make sure
 	 * things can be added to it.
@@ -642,6 +686,10 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 * Note that c_isidle becomes true briefly even if we don't go
 	 * idle. However, because one is supposed to hold the runqueue
 	 * lock to look at it, this should not be visible or matter.
+	 *
+	 * Zero pages one at a time with interrupts on, so a wakeup
+	 * isn't kept waiting; an interrupt that lands in the middle
+	 * finds c_isidle set and doesn't try to switch.
 	 */
 
 	/* The current cpu is now idle. */
@@ -650,7 +698,12 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			spl0();
+			zeroed = coremap_zerofill();
+			splhigh();
+			if (!zeroed) {
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -1168,28 +1221,107 @@ ipi_broadcast(int code)
 	}
 }
 
-void
-ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+/*
+ * Queue the NMAPPINGS shootdowns in MAPPINGS on TARGET, or a full
+ * flush if NMAPPINGS is TLBSHOOTDOWN_ALL, and send one IPI for the
+ * lot. Returns the ticket to wait for. Call with TARGET's IPI lock
+ * held.
+ */
+static
+uint32_t
+ipi_tlbshootdown_queue(struct cpu *target,
+		       const struct tlbshootdown *mappings, int nmappings)
 {
-	int n;
+	int n, i;
 
-	spinlock_acquire(&target->c_ipi_lock);
+	KASSERT(spinlock_do_i_hold(&target->c_ipi_lock));
 
 	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
+	if (n == TLBSHOOTDOWN_ALL) {
+		/* Already flushing everything. */
+	}
+	else if (nmappings == TLBSHOOTDOWN_ALL ||
+		 n + nmappings > TLBSHOOTDOWN_MAX) {
 		target->c_numshootdown = TLBSHOOTDOWN_ALL;
 	}
 	else {
-		target->c_shootdown[n] = *mapping;
-		target->c_numshootdown = n+1;
+		for (i=0; i<nmappings; i++) {
+			target->c_shootdown[n+i] = mappings[i];
+		}
+		target->c_numshootdown = n + nmappings;
 	}
 
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
 	mainbus_send_ipi(target);
 
+	return ++target->c_shootdown_queued;
+}
+
+void
+ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+{
+	spinlock_acquire(&target->c_ipi_lock);
+	ipi_tlbshootdown_queue(target, mapping, 1);
 	spinlock_release(&target->c_ipi_lock);
 }
 
+void
+ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping)
+{
+	ipi_tlbshootdown_cpus(~((uint32_t)1 << curcpu->c_number), mapping, 1);
+}
+
+unsigned
+ipi_tlbshootdown_cpus(uint32_t cpumask, const struct tlbshootdown *mappings,
+		      int n)
+{
+	unsigned i, nsent;
+	struct cpu *c;
+	uint32_t tickets[MAXCPUS];
+	bool done;
+
+	KASSERT(n == TLBSHOOTDOWN_ALL || (n > 0 && n <= TLBSHOOTDOWN_MAX));
+
+	/*
+	 * Send to every target first, then wait for each one to get
+	 * to our request, so they all work on it at the same time. We
+	 * must not hold spinlocks while waiting, or a cpu doing the
+	 * same thing to us would never get an answer.
+	 *
+	 * The current cpu isn't skipped: if the caller has been
+	 * migrated since it picked the targets, it interrupts itself.
+	 */
+	KASSERT(curcpu->c_spinlocks == 0);
+
+	nsent = 0;
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if ((cpumask & ((uint32_t)1 << c->c_number)) == 0) {
+			continue;
+		}
+
+		spinlock_acquire(&c->c_ipi_lock);
+		tickets[i] = ipi_tlbshootdown_queue(c, mappings, n);
+		spinlock_release(&c->c_ipi_lock);
+		nsent++;
+	}
+
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if ((cpumask & ((uint32_t)1 << c->c_number)) == 0) {
+			continue;
+		}
+
+		do {
+			spinlock_acquire(&c->c_ipi_lock);
+			done = (int32_t)(c->c_shootdown_done - tickets[i]) >= 0;
+			spinlock_release(&c->c_ipi_lock);
+		} while (!done);
+	}
+
+	return nsent;
+}
+
 void
 interprocessor_interrupt(void)
 {
@@ -1232,6 +1364,7 @@ interprocessor_interrupt(void)
 			}
 		}
 		curcpu->c_numshootdown = 0;
+		curcpu->c_shootdown_done = curcpu->c_shootdown_queued;
 	}
 
 	curcpu->c_ipi_pending = 0;
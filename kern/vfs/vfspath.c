@@ -38,6 +38,7 @@
 #include <lib.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <textcache.h>
 
 
 /* Does most of the work for open(). */
@@ -97,6 +98,10 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 		if (canwrite==0) {
 			result = EINVAL;
 		}
+		else if (textcache_busy(vn)) {
+			/* It's a running program; see textcache.h */
+			result = ETXTBSY;
+		}
 		else {
 			result = VOP_TRUNCATE(vn, 0);
 		}
@@ -29,16 +29,24 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
 #include <lib.h>
-#include <spl.h>
+#include <array.h>
 #include <spinlock.h>
 #include <proc.h>
 #include <current.h>
-#include <mips/tlb.h>
+#include <elf.h>
+#include <uio.h>
+#include <vnode.h>
 #include <addrspace.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <swap.h>
+#include <textcache.h>
 #include <vm.h>
 
-#define DUMBVM_STACKPAGES    18
+static int as_msync_region(struct addrspace *as, struct region *rg,
+			   bool final);
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -59,115 +67,248 @@ as_create(void)
 	/*
 	 * Initialize as needed.
 	 */
-	as->as_vbase1 = 0;
-        as->as_pbase1 = 0;
-        as->as_npages1 = 0;
-        as->as_vbase2 = 0;
-        as->as_pbase2 = 0;
-        as->as_npages2 = 0;
-        as->as_stackpbase = 0;
-
-	as->ptable = array_create();
-	as->isloaded = false;
-	
+	as->as_regions = array_create();
+	if (as->as_regions == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		array_destroy(as->as_regions);
+		kfree(as);
+		return NULL;
+	}
+	as->as_heap.rg_vbase = 0;
+	as->as_heap.rg_npages = 0;
+	as->as_heap.rg_perms = PF_R | PF_W;
+	as->as_heap.rg_vnode = NULL;
+	as->as_heap.rg_fileoff = 0;
+	as->as_heap.rg_segstart = 0;
+	as->as_heap.rg_filesz = 0;
+	as->as_heap.rg_mmap = 0;
+	as->as_heap.rg_advice = MADV_NORMAL;
+	as->as_heaptop = 0;
+	as->as_stack = as->as_heap;
+	as->as_stack.rg_vbase = USERSTACK;
+	as->as_stacklimit = USERSTACK;
+	bzero(&as->as_asids, sizeof(as->as_asids));
 	return as;
 }
 
+/*
+ * Add a region to AS.
+ */
+static
 int
-as_copy(struct addrspace *old, struct addrspace **ret)
+as_add_region(struct addrspace *as, vaddr_t vaddr, size_t npages, int perms)
 {
-	struct addrspace *new;
+	struct region *rg;
+	int result;
 
-	new = as_create();
-	if (new==NULL) {
+	rg = kmalloc(sizeof(struct region));
+	if (rg == NULL) {
 		return ENOMEM;
 	}
+	rg->rg_vbase = vaddr;
+	rg->rg_npages = npages;
+	rg->rg_perms = perms;
+	rg->rg_vnode = NULL;
+	rg->rg_fileoff = 0;
+	rg->rg_segstart = vaddr;
+	rg->rg_filesz = 0;
+	rg->rg_mmap = 0;
+	rg->rg_advice = MADV_NORMAL;
 
-	/*
-	 * Write this.
-	 */
-	new->as_vbase1 = old->as_vbase1;
-        new->as_npages1 = old->as_npages1;
-        new->as_vbase2 = old->as_vbase2;
-        new->as_npages2 = old->as_npages2;
-
-        /* (Mis)use as_prepare_load to allocate some physical memory. */
-        if (as_prepare_load(new)) {
-                as_destroy(new);
-                return ENOMEM;
-        }
-	
-        KASSERT(new->as_pbase1 != 0);
-        KASSERT(new->as_pbase2 != 0);
-        KASSERT(new->as_stackpbase != 0);
+	result = array_add(as->as_regions, rg, NULL);
+	if (result) {
+		kfree(rg);
+		return result;
+	}
+	return 0;
+}
+
+struct region *
+as_find_region(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg;
+	unsigned i, num;
 
-	unsigned int i;
-	struct page *p;
+	num = array_num(as->as_regions);
+	for (i = 0; i < num; i++) {
+		rg = array_get(as->as_regions, i);
+		if (vaddr >= rg->rg_vbase &&
+		    vaddr < rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+			return rg;
+		}
+	}
 
-//------------------TEXT SEGMENT-----------------//
-	new->as_pbase1 = getppages(new->as_npages1);
-	if (new->as_pbase1 == 0) {
-		return ENOMEM;
+	rg = &as->as_heap;
+	if (vaddr >= rg->rg_vbase &&
+	    vaddr < rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+		return rg;
 	}
-	
-	KASSERT(new->as_pbase1 != 0);
-
-	for (i = 0; i < new->as_npages1; i++)
-	{
-		p = kmalloc(sizeof(struct page));
-		p->vaddr = new->as_vbase1 + i * PAGE_SIZE;
-		p->paddr = new->as_pbase1 + i * PAGE_SIZE;
-		p->valid = 1;
-		p->perms = 0x5;
-		array_add(new->ptable, p, NULL);
-	}	
-
-        memmove((void *)PADDR_TO_KVADDR(new->as_pbase1),
-                (const void *)PADDR_TO_KVADDR(old->as_pbase1),
-                old->as_npages1*PAGE_SIZE);
-//-------------------DATA SEGMENT---------------//
-	new->as_pbase2 = getppages(new->as_npages2);
-	if (new->as_pbase2 == 0) {
-		return ENOMEM;
+	rg = &as->as_stack;
+	if (vaddr >= rg->rg_vbase && vaddr < USERSTACK) {
+		return rg;
+	}
+	return NULL;
+}
+
+/*
+ * Give NEW the page at VADDR that OLDPTE describes in the parent.
+ *
+ * Resident pages are shared copy-on-write: both address spaces get a
+ * read-only mapping of the same frame, and whoever writes first gets
+ * a copy (see vm_fault). Pages in swap are read into a frame of the
+ * child's own, since swap slots aren't shared. Untouched pages stay
+ * untouched in the child too.
+ *
+ * Pages of MAP_SHARED regions (SHARED) are never copied: both sides
+ * keep writing to the same frame, so a swapped one is brought back
+ * into the parent first and then shared like any other.
+ */
+static
+int
+as_copy_page(struct addrspace *old, struct addrspace *new, vaddr_t vaddr,
+	     bool shared, pte_t *oldpte, pte_t *newpte)
+{
+	paddr_t paddr;
+	unsigned slot;
+	int result;
+
+	if (coremap_pin(oldpte)) {
+		paddr = *oldpte & PTE_FRAME;
+		if (!shared) {
+			*oldpte &= ~PTE_WRITE;
+		}
+		coremap_incref(paddr);
+		*newpte = *oldpte;
+		coremap_unpin(paddr);
+		return 0;
 	}
 
-	KASSERT(new->as_pbase2 != 0);
+	if ((*oldpte & PTE_SWAPPED) == 0) {
+		return 0;
+	}
+	slot = PTE_SWAPSLOT(*oldpte);
 
-	for (i = 0; i < new->as_npages2; i++)
-	{
-		p = kmalloc(sizeof(struct page));
-		p->vaddr = new->as_vbase2 + i * PAGE_SIZE;
-		p->paddr = new->as_pbase2 + i * PAGE_SIZE;
-		p->valid = 1;
-		p->perms = 0x6;
-		array_add(new->ptable, p, NULL);
+	if (shared) {
+		paddr = coremap_alloc_upage(old, vaddr);
+		if (paddr == 0) {
+			return ENOMEM;
+		}
+		result = swap_in(slot, paddr);
+		if (result) {
+			coremap_free_upage(paddr, old);
+			return result;
+		}
+		swap_free(slot);
+		/* The file hasn't seen it yet. */
+		coremap_setdirty(paddr, old, vaddr);
+		*oldpte = paddr | PTE_VALID;
+		coremap_incref(paddr);
+		*newpte = *oldpte;
+		coremap_unpin(paddr);
+		return 0;
 	}
 
-        memmove((void *)PADDR_TO_KVADDR(new->as_pbase2),
-                (const void *)PADDR_TO_KVADDR(old->as_pbase2),
-                old->as_npages2*PAGE_SIZE);
-//--------------------STACK SEGMENT--------------//
-        new->as_stackpbase = getppages(DUMBVM_STACKPAGES);
-	if (new->as_stackpbase == 0) {
+	paddr = coremap_alloc_upage(new, vaddr);
+	if (paddr == 0) {
+		return ENOMEM;
+	}
+	result = swap_in(slot, paddr);
+	if (result) {
+		coremap_free_upage(paddr, new);
+		return result;
+	}
+	/* Not backed by anything yet, so it starts out dirty. */
+	coremap_setdirty(paddr, new, vaddr);
+	*newpte = paddr | PTE_VALID;
+	coremap_unpin(paddr);
+	return 0;
+}
+
+int
+as_copy(struct addrspace *old, struct addrspace **ret)
+{
+	struct addrspace *new;
+	struct region *rg, *newrg;
+	pte_t *oldleaf, *newpte;
+	vaddr_t vaddr;
+	unsigned i, j;
+	bool shared;
+	int result;
+
+	new = as_create();
+	if (new==NULL) {
 		return ENOMEM;
 	}
 
-	KASSERT(new->as_stackpbase != 0);
+	for (i = 0; i < array_num(old->as_regions); i++) {
+		rg = array_get(old->as_regions, i);
+		result = as_add_region(new, rg->rg_vbase, rg->rg_npages,
+				       rg->rg_perms);
+		if (result) {
+			as_destroy(new);
+			return result;
+		}
+		newrg = array_get(new->as_regions, i);
+		newrg->rg_advice = rg->rg_advice;
+		if (textcache_istext(rg)) {
+			result = textcache_attach(rg->rg_vnode);
+			if (result) {
+				as_destroy(new);
+				return result;
+			}
+		}
+		if (rg->rg_vnode != NULL) {
+			VOP_INCREF(rg->rg_vnode);
+			newrg->rg_vnode = rg->rg_vnode;
+			newrg->rg_fileoff = rg->rg_fileoff;
+			newrg->rg_segstart = rg->rg_segstart;
+			newrg->rg_filesz = rg->rg_filesz;
+			newrg->rg_mmap = rg->rg_mmap;
+		}
+	}
+	new->as_heap = old->as_heap;
+	new->as_heaptop = old->as_heaptop;
+	new->as_stack = old->as_stack;
+	new->as_stacklimit = old->as_stacklimit;
 
-	for (i = 0; i < DUMBVM_STACKPAGES; i++)
-	{
-		p = kmalloc(sizeof(struct page));
-		p->vaddr = USERSTACK - i * PAGE_SIZE;
-		p->paddr = new->as_stackpbase + i * PAGE_SIZE;
-		p->valid = 1;
-		p->perms = 0x7;
-		array_add(new->ptable, p, NULL);
+	for (i = 0; i < PT_NDIR; i++) {
+		oldleaf = pt_leaf(old->as_pt, i);
+		if (oldleaf == NULL) {
+			continue;
+		}
+		for (j = 0; j < PT_NLEAF; j++) {
+			if (oldleaf[j] == 0) {
+				continue;
+			}
+			vaddr = PT_VADDR(i, j);
+			rg = as_find_region(old, vaddr);
+			shared = rg != NULL && rg->rg_mmap == MAP_SHARED;
+			newpte = pt_lookup(new->as_pt, vaddr, true);
+			if (newpte == NULL) {
+				result = ENOMEM;
+			}
+			else {
+				result = as_copy_page(old, new, vaddr, shared,
+						      &oldleaf[j], newpte);
+			}
+			if (result) {
+				as_destroy(new);
+				asid_invalidate(old);
+				return result;
+			}
+		}
 	}
 
-	memmove((void *)PADDR_TO_KVADDR(new->as_stackpbase),
-                (const void *)PADDR_TO_KVADDR(old->as_stackpbase),
-                DUMBVM_STACKPAGES*PAGE_SIZE);
-	
+	/*
+	 * The parent may still have writeable TLB entries for these,
+	 * here or on any CPU it has run on.
+	 */
+	asid_invalidate(old);
+
 	*ret = new;
 	return 0;
 }
@@ -178,41 +319,87 @@ as_destroy(struct addrspace *as)
 	/*
 	 * Clean up as needed.
 	 */
+	struct region *rg;
+	pte_t *leaf;
+	unsigned i, j;
+
+	/* Shared mappings go back to their files; there's no one to tell. */
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_mmap == MAP_SHARED) {
+			(void)as_msync_region(as, rg, true);
+		}
+	}
+
+	/*
+	 * Give the frames and swap slots back. Pinning each page first
+	 * waits out the pager if it's working on it.
+	 */
+	for (i = 0; i < PT_NDIR; i++) {
+		leaf = pt_leaf(as->as_pt, i);
+		if (leaf == NULL) {
+			continue;
+		}
+		for (j = 0; j < PT_NLEAF; j++) {
+			if (leaf[j] == 0) {
+				continue;
+			}
+			if (coremap_pin(&leaf[j])) {
+				coremap_free_upage(leaf[j] & PTE_FRAME, as);
+			}
+			else if (leaf[j] & PTE_SWAPPED) {
+				swap_free(PTE_SWAPSLOT(leaf[j]));
+			}
+			leaf[j] = 0;
+		}
+	}
+	pt_destroy(as->as_pt);
+	asid_invalidate(as);
+
+	while (array_num(as->as_regions) > 0) {
+		i = array_num(as->as_regions) - 1;
+		rg = array_get(as->as_regions, i);
+		if (textcache_istext(rg)) {
+			/* Our text pages may have been the last users. */
+			textcache_detach(rg->rg_vnode);
+		}
+		if (rg->rg_vnode != NULL) {
+			VOP_DECREF(rg->rg_vnode);
+		}
+		kfree(rg);
+		array_remove(as->as_regions, i);
+	}
+	array_destroy(as->as_regions);
+
 	kfree(as);
 }
 
 void
 as_activate(void)
 {
-	int i, spl;
         struct addrspace *as;
 
         as = proc_getas();
         if (as == NULL) {
+		/*
+		 * Kernel thread. Leave the old ID in place, but don't
+		 * let the refill handler walk a page table that may
+		 * go away under it.
+		 */
+		vm_utlb_setpt(NULL);
                 return;
         }
 
-        /* Disable interrupts on this CPU while frobbing the TLB. */
-        spl = splhigh();
-
-        for (i=0; i<NUM_TLB; i++) {
-                tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
-        }
-
-        splx(spl);
-	/*
-	 * Write this.
-	 */
+	/* Our translations stay in the TLB, tagged with our ID. */
+	asid_activate(as);
+	vm_utlb_setpt(as->as_pt);
 }
 
 void
 as_deactivate(void)
 {
-	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
-	 */
+	/* The page table is about to be destroyed. */
+	vm_utlb_setpt(NULL);
 }
 
 /*
@@ -221,17 +408,14 @@ as_deactivate(void)
  * VADDR+MEMSIZE.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * write, or execute permission should be set on the segment. They
+ * are recorded in the region; pages in regions without WRITEABLE are
+ * mapped read-only.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 		 int readable, int writeable, int executable)
 {
-	/*
-	 * Write this.
-	 */
 	size_t npages;
 
         /* Align the region. First, the base... */
@@ -243,107 +427,739 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 
         npages = sz / PAGE_SIZE;
 
-        /* We don't use these - all pages are read-write */
-	unsigned int i;
-	struct page *p;
-	
-	for(i = 0; i < npages; i++){
-		p = kmalloc(sizeof(struct page));
-		p->vaddr = vaddr + i * PAGE_SIZE;
-		p->perms = readable | writeable | executable;
-		p->valid = 0;
-		array_add(as->ptable, p, NULL);		
-	}
-
-        if (as->as_vbase1 == 0) {
-                as->as_vbase1 = vaddr;
-                as->as_npages1 = npages;
-                return 0;
-        }
+	if (vaddr + sz > USERSPACETOP || vaddr + sz < vaddr) {
+		return EFAULT;
+	}
 
-        if (as->as_vbase2 == 0) {
-                as->as_vbase2 = vaddr;
-                as->as_npages2 = npages;
-                return 0;
-        }
+	return as_add_region(as, vaddr, npages,
+			     readable | writeable | executable);
+}
+
+/*
+ * Attach file backing to the region containing VADDR (which was set
+ * up with as_define_region): FILESZ bytes of V starting at OFFSET
+ * appear at VADDR. Nothing is read now; see as_fill_page.
+ */
+int
+as_define_backing(struct addrspace *as, vaddr_t vaddr,
+		  struct vnode *v, off_t offset, size_t filesz)
+{
+	struct region *rg;
+	int result;
+
+	rg = as_find_region(as, vaddr);
+	if (rg == NULL) {
+		return EFAULT;
+	}
+	if (vaddr + filesz > rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+		return ENOEXEC;
+	}
+	if (rg->rg_vnode != NULL) {
+		/* Two segments in one region; see as_complete_load */
+		return ENOEXEC;
+	}
 
-        /*
- *          * Support for more than two regions is not available.
- *                   */
-        kprintf("dumbvm: Warning: too many regions\n");
-	return ENOSYS;
+	rg->rg_vnode = v;
+	if (textcache_istext(rg)) {
+		result = textcache_attach(v);
+		if (result) {
+			rg->rg_vnode = NULL;
+			return result;
+		}
+	}
+	VOP_INCREF(v);
+	rg->rg_fileoff = offset;
+	rg->rg_segstart = vaddr;
+	rg->rg_filesz = filesz;
+	return 0;
 }
 
-static
-void
-as_zero_region(paddr_t paddr, unsigned npages)
+bool
+as_filedata(struct region *rg, vaddr_t vaddr,
+	    off_t *offset, size_t *pageoff, size_t *len)
+{
+	vaddr_t start, end;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	if (rg->rg_vnode == NULL) {
+		return false;
+	}
+
+	start = vaddr > rg->rg_segstart ? vaddr : rg->rg_segstart;
+	end = rg->rg_segstart + rg->rg_filesz;
+	if (end > vaddr + PAGE_SIZE) {
+		end = vaddr + PAGE_SIZE;
+	}
+	if (start >= end) {
+		return false;
+	}
+
+	*offset = rg->rg_fileoff + (start - rg->rg_segstart);
+	*pageoff = start - vaddr;
+	*len = end - start;
+	return true;
+}
+
+int
+as_fill_page(struct region *rg, vaddr_t vaddr, paddr_t paddr)
 {
-        bzero((void *)PADDR_TO_KVADDR(paddr), npages * PAGE_SIZE);
+	struct iovec iov;
+	struct uio ku;
+	off_t offset;
+	size_t pageoff, len;
+	int result;
+
+	if (!as_filedata(rg, vaddr, &offset, &pageoff, &len)) {
+		return 0;
+	}
+
+	uio_kinit(&iov, &ku, (void *)(PADDR_TO_KVADDR(paddr) + pageoff),
+		  len, offset, UIO_READ);
+	result = VOP_READ(rg->rg_vnode, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		/* short read; problem with executable? */
+		kprintf("ELF: short read on segment - file truncated?\n");
+		return ENOEXEC;
+	}
+	return 0;
 }
 
 int
 as_prepare_load(struct addrspace *as)
 {
 	/*
-	 * Write this.
+	 * Nothing to do: segments are paged in from the executable
+	 * on first touch.
 	 */
-	KASSERT(as->as_pbase1 == 0);
-        KASSERT(as->as_pbase2 == 0);
-        KASSERT(as->as_stackpbase == 0);
+	(void)as;
+	return 0;
+}
 
-        as->as_pbase1 = getppages(as->as_npages1);
-        if (as->as_pbase1 == 0) {
-                return ENOMEM;
-        }
+/*
+ * Finish setting up the program's address space. Since segments are
+ * paged in later rather than read now, this is the last chance to
+ * reject an executable whose segments overlap: the fault path would
+ * only ever find one of them.
+ */
+int
+as_complete_load(struct addrspace *as)
+{
+	struct region *rg, *other;
+	vaddr_t end;
+	unsigned i, j, num;
 
-        as->as_pbase2 = getppages(as->as_npages2);
-        if (as->as_pbase2 == 0) {
-                return ENOMEM;
-        }
+	num = array_num(as->as_regions);
+	for (i = 0; i < num; i++) {
+		rg = array_get(as->as_regions, i);
+		for (j = i + 1; j < num; j++) {
+			other = array_get(as->as_regions, j);
+			if (rg->rg_vbase <
+			    other->rg_vbase + other->rg_npages * PAGE_SIZE &&
+			    other->rg_vbase <
+			    rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+				kprintf("ELF: overlapping segments\n");
+				return ENOEXEC;
+			}
+		}
+	}
 
-        as->as_stackpbase = getppages(DUMBVM_STACKPAGES);
-        if (as->as_stackpbase == 0) {
-                return ENOMEM;
-        }
+	/* The heap starts out empty, just past the highest segment. */
+	end = 0;
+	for (i = 0; i < num; i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_vbase + rg->rg_npages * PAGE_SIZE > end) {
+			end = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		}
+	}
+	as->as_heap.rg_vbase = end;
+	as->as_heap.rg_npages = 0;
+	as->as_heaptop = end;
+	return 0;
+}
 
-        as_zero_region(as->as_pbase1, as->as_npages1);
-        as_zero_region(as->as_pbase2, as->as_npages2);
-        as_zero_region(as->as_stackpbase, DUMBVM_STACKPAGES);
+/*
+ * Throw away NPAGES pages starting at VADDR: unmap them everywhere,
+ * then free their frames or swap slots. Resident pages are shot down
+ * UNMAP_BATCH at a time, holding on to their frames until the TLBs
+ * have let go of them.
+ */
+#define UNMAP_BATCH	32
 
-        return 0;
+static
+void
+as_unmap_range(struct addrspace *as, vaddr_t vaddr, size_t npages)
+{
+	struct tlbbatch tb;
+	paddr_t frames[UNMAP_BATCH];
+	unsigned nframes, i;
+	pte_t *pte;
+
+	vm_tlbbatch_init(&tb, as);
+	nframes = 0;
+	for (; npages > 0; npages--, vaddr += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, vaddr, false);
+		if (pte == NULL || *pte == 0) {
+			continue;
+		}
+		if (!coremap_pin(pte)) {
+			if (*pte & PTE_SWAPPED) {
+				swap_free(PTE_SWAPSLOT(*pte));
+			}
+			*pte = 0;
+			continue;
+		}
+		frames[nframes++] = *pte & PTE_FRAME;
+		*pte = 0;
+		vm_tlbbatch_add(&tb, vaddr);
+		if (nframes == UNMAP_BATCH) {
+			vm_tlbbatch_flush(&tb);
+			for (i = 0; i < nframes; i++) {
+				coremap_free_upage(frames[i], as);
+			}
+			nframes = 0;
+		}
+	}
+	if (nframes > 0) {
+		vm_tlbbatch_flush(&tb);
+		for (i = 0; i < nframes; i++) {
+			coremap_free_upage(frames[i], as);
+		}
+	}
 }
 
 int
-as_complete_load(struct addrspace *as)
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
 {
-	/*
-	 * Write this.
-	 */
+	struct region *rg, *heap;
+	vaddr_t base, oldtop, newtop, newend;
+	size_t oldpages, newpages, i;
+
+	heap = &as->as_heap;
+	base = heap->rg_vbase;
+	oldtop = as->as_heaptop;
+
+	/* Negate unsigned: -amount overflows for INT_MIN. */
+	if (amount < 0 && (vaddr_t)0 - (vaddr_t)amount > oldtop - base) {
+		return EINVAL;
+	}
+	newtop = oldtop + amount;
+	if (amount > 0 && (newtop < oldtop || newtop > USERSPACETOP)) {
+		return ENOMEM;
+	}
+
+	oldpages = heap->rg_npages;
+	newpages = DIVROUNDUP(newtop - base, PAGE_SIZE);
+
+	if (newpages > oldpages) {
+		/* Don't run into anything else, such as the stack. */
+		newend = base + newpages * PAGE_SIZE;
+		if (newend > as->as_stacklimit - STACK_GUARDPAGES * PAGE_SIZE) {
+			return ENOMEM;
+		}
+		for (i = 0; i < array_num(as->as_regions); i++) {
+			rg = array_get(as->as_regions, i);
+			if (rg->rg_vbase < newend &&
+			    rg->rg_vbase + rg->rg_npages * PAGE_SIZE > base) {
+				return ENOMEM;
+			}
+		}
+	}
+	else {
+		as_unmap_range(as, base + newpages * PAGE_SIZE,
+			       oldpages - newpages);
+	}
+
+	heap->rg_npages = newpages;
+	as->as_heaptop = newtop;
+	*oldbreak = oldtop;
+	return 0;
+}
+
+/*
+ * Find NPAGES of unused address space for a mapping. Mappings are
+ * stacked downward from just under the space set aside for the stack,
+ * leaving the room above the break for the heap to grow into.
+ */
+static
+int
+as_find_space(struct addrspace *as, size_t npages, vaddr_t *ret)
+{
+	struct region *rg;
+	vaddr_t start, end, floor;
+	unsigned i;
+
+	floor = as->as_heap.rg_vbase + as->as_heap.rg_npages * PAGE_SIZE;
+	end = as->as_stacklimit - STACK_GUARDPAGES * PAGE_SIZE;
+ again:
+	if (end < floor || end - floor < npages * PAGE_SIZE) {
+		return ENOMEM;
+	}
+	start = end - npages * PAGE_SIZE;
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_vbase < end &&
+		    rg->rg_vbase + rg->rg_npages * PAGE_SIZE > start) {
+			end = rg->rg_vbase;
+			goto again;
+		}
+	}
+	*ret = start;
+	return 0;
+}
+
+int
+as_mmap(struct addrspace *as, size_t len, int prot, int flags,
+	struct vnode *v, off_t offset, off_t filesize, vaddr_t *ret)
+{
+	struct region *rg;
+	vaddr_t vaddr;
+	size_t npages;
+	int perms, result;
+
+	KASSERT(len > 0);
+	KASSERT(offset >= 0 && offset % PAGE_SIZE == 0);
+	KASSERT(flags == MAP_SHARED || flags == MAP_PRIVATE);
+
+	if (len > USERSPACETOP) {
+		return ENOMEM;
+	}
+	npages = DIVROUNDUP(len, PAGE_SIZE);
+
+	result = as_find_space(as, npages, &vaddr);
+	if (result) {
+		return result;
+	}
+
+	perms = 0;
+	if (prot & PROT_READ) {
+		perms |= PF_R;
+	}
+	if (prot & PROT_WRITE) {
+		perms |= PF_W;
+	}
+	if (prot & PROT_EXEC) {
+		perms |= PF_X;
+	}
+	result = as_add_region(as, vaddr, npages, perms);
+	if (result) {
+		return result;
+	}
+	rg = array_get(as->as_regions, array_num(as->as_regions) - 1);
+
+	VOP_INCREF(v);
+	rg->rg_vnode = v;
+	rg->rg_fileoff = offset;
+	rg->rg_segstart = vaddr;
+	if (offset >= filesize) {
+		rg->rg_filesz = 0;
+	}
+	else if (filesize - offset < (off_t)len) {
+		rg->rg_filesz = filesize - offset;
+	}
+	else {
+		rg->rg_filesz = len;
+	}
+	rg->rg_mmap = flags;
+
+	*ret = vaddr;
+	return 0;
+}
+
+/*
+ * Write the page at VADDR, held in the frame at PADDR, to RG's file.
+ * Only the part that came from the file goes back; a mapping never
+ * makes the file longer.
+ */
+static
+int
+as_writepage(struct region *rg, vaddr_t vaddr, paddr_t paddr)
+{
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t end;
+
+	end = rg->rg_segstart + rg->rg_filesz;
+	if (vaddr >= end) {
+		return 0;
+	}
+	if (end > vaddr + PAGE_SIZE) {
+		end = vaddr + PAGE_SIZE;
+	}
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(paddr), end - vaddr,
+		  rg->rg_fileoff + (vaddr - rg->rg_segstart), UIO_WRITE);
+	return VOP_WRITE(rg->rg_vnode, &ku);
+}
+
+/*
+ * Write back the page at VADDR of the MAP_SHARED region RG if it has
+ * been modified. Unless AS is going away (FINAL), a page only we map
+ * is made read-only and marked clean, so the next write is noticed
+ * and the pager can drop it without going to swap. A frame shared
+ * with a forked child stays dirty, since we can't reach the child's
+ * TLB entries.
+ */
+static
+int
+as_syncpage(struct addrspace *as, struct region *rg, vaddr_t vaddr,
+	    bool final)
+{
+	pte_t *pte;
+	paddr_t paddr;
+	vaddr_t kva;
+	bool clean;
+	int result;
+
+	pte = pt_lookup(as->as_pt, vaddr, false);
+	if (pte == NULL || *pte == 0) {
+		return 0;
+	}
+
+	if (coremap_pin(pte)) {
+		paddr = *pte & PTE_FRAME;
+		if (!coremap_isdirty(paddr)) {
+			coremap_unpin(paddr);
+			return 0;
+		}
+		clean = !final && coremap_refcount(paddr) == 1;
+		if (clean && (*pte & PTE_WRITE)) {
+			*pte &= ~PTE_WRITE;
+			vm_tlbshootdown_page(as, vaddr);
+		}
+		result = as_writepage(rg, vaddr, paddr);
+		if (result == 0 && clean) {
+			coremap_setclean(paddr);
+		}
+		coremap_unpin(paddr);
+		return result;
+	}
+
+	if ((*pte & PTE_SWAPPED) == 0) {
+		return 0;
+	}
+
+	/* Only modified pages go to swap; bring it back just to write it. */
+	kva = alloc_kpages(1);
+	if (kva == 0) {
+		return ENOMEM;
+	}
+	result = swap_in(PTE_SWAPSLOT(*pte), KVADDR_TO_PADDR(kva));
+	if (result == 0) {
+		result = as_writepage(rg, vaddr, KVADDR_TO_PADDR(kva));
+	}
+	free_kpages(kva);
+	return result;
+}
+
+/*
+ * Write back every modified page of the MAP_SHARED region RG. Keeps
+ * going after an error, returning the first one.
+ */
+static
+int
+as_msync_region(struct addrspace *as, struct region *rg, bool final)
+{
+	size_t i;
+	int result, ret = 0;
+
+	KASSERT(rg->rg_mmap == MAP_SHARED);
+
+	for (i = 0; i < rg->rg_npages; i++) {
+		result = as_syncpage(as, rg, rg->rg_vbase + i * PAGE_SIZE,
+				     final);
+		if (result && ret == 0) {
+			ret = result;
+		}
+	}
+	return ret;
+}
+
+int
+as_msync_vnode(struct addrspace *as, struct vnode *v)
+{
+	struct region *rg;
+	unsigned i;
+	int result, ret = 0;
+
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_vnode != v || rg->rg_mmap != MAP_SHARED) {
+			continue;
+		}
+		result = as_msync_region(as, rg, false);
+		if (result && ret == 0) {
+			ret = result;
+		}
+	}
+	return ret;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct region *rg;
+	vaddr_t end, rgend;
+	unsigned i;
+	int result, ret = 0;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
 
-   	as->isloaded = true; 
+	end = vaddr + len;
+	if (end < vaddr || end > USERSPACETOP) {
+		return EINVAL;
+	}
+
+	/* Check everything first, so we don't fail halfway through. */
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		rgend = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		if (rg->rg_vbase >= end || rgend <= vaddr) {
+			continue;
+		}
+		if (rg->rg_mmap == 0 || rg->rg_vbase < vaddr || rgend > end) {
+			return EINVAL;
+		}
+	}
+
+	i = array_num(as->as_regions);
+	while (i-- > 0) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_vbase >= end ||
+		    rg->rg_vbase + rg->rg_npages * PAGE_SIZE <= vaddr) {
+			continue;
+		}
+		if (rg->rg_mmap == MAP_SHARED) {
+			result = as_msync_region(as, rg, true);
+			if (result && ret == 0) {
+				ret = result;
+			}
+		}
+		as_unmap_range(as, rg->rg_vbase, rg->rg_npages);
+		array_remove(as->as_regions, i);
+		VOP_DECREF(rg->rg_vnode);
+		kfree(rg);
+	}
+	return ret;
+}
+
+int
+as_grow_stack(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *stack = &as->as_stack;
 
+	if (vaddr < as->as_stacklimit || vaddr >= stack->rg_vbase) {
+		return EFAULT;
+	}
+	vaddr &= PAGE_FRAME;
+	stack->rg_npages = (USERSTACK - vaddr) / PAGE_SIZE;
+	stack->rg_vbase = vaddr;
+	return 0;
+}
+
+/*
+ * Check that every page in [VADDR, END) is in some region.
+ */
+static
+int
+as_check_range(struct addrspace *as, vaddr_t vaddr, vaddr_t end)
+{
+	struct region *rg;
+
+	while (vaddr < end) {
+		rg = as_find_region(as, vaddr);
+		if (rg == NULL) {
+			return ENOMEM;
+		}
+		vaddr = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+	}
+	return 0;
+}
+
+/*
+ * MADV_FREE: the contents of NPAGES pages from VADDR no longer
+ * matter. Resident pages only we use are marked clean, with no copy in
+ * swap, and left for the pager to take first; it just drops them, and
+ * they come back zero-filled. They're made read-only, so that a write
+ * before that happens marks them dirty again and keeps them. Pages
+ * in swap are dropped at once.
+ */
+static
+void
+as_free_range(struct addrspace *as, vaddr_t vaddr, size_t npages)
+{
+	struct tlbbatch tb;
+	paddr_t frames[UNMAP_BATCH];
+	unsigned nframes, i;
+	paddr_t paddr;
+	pte_t *pte;
+
+	vm_tlbbatch_init(&tb, as);
+	nframes = 0;
+	for (; npages > 0; npages--, vaddr += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, vaddr, false);
+		if (pte == NULL || *pte == 0) {
+			continue;
+		}
+		if (!coremap_pin(pte)) {
+			if (*pte & PTE_SWAPPED) {
+				swap_free(PTE_SWAPSLOT(*pte));
+				*pte = 0;
+			}
+			continue;
+		}
+		paddr = *pte & PTE_FRAME;
+		if (coremap_refcount(paddr) > 1) {
+			/* Shared copy-on-write; the others still need it. */
+			coremap_unpin(paddr);
+			continue;
+		}
+		if (*pte & PTE_WRITE) {
+			*pte &= ~PTE_WRITE;
+			vm_tlbbatch_add(&tb, vaddr);
+		}
+		frames[nframes++] = paddr;
+		if (nframes == UNMAP_BATCH || npages == 1) {
+			/* Only once no TLB can write to them. */
+			vm_tlbbatch_flush(&tb);
+			for (i = 0; i < nframes; i++) {
+				coremap_setdiscard(frames[i]);
+				coremap_unpin(frames[i]);
+			}
+			nframes = 0;
+		}
+	}
+	vm_tlbbatch_flush(&tb);
+	for (i = 0; i < nframes; i++) {
+		coremap_setdiscard(frames[i]);
+		coremap_unpin(frames[i]);
+	}
+}
+
+int
+as_madvise(struct addrspace *as, vaddr_t vaddr, size_t len, int advice)
+{
+	struct region *rg;
+	vaddr_t end, rgend, va;
+	int result;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	end = vaddr + ((len + PAGE_SIZE - 1) & PAGE_FRAME);
+	if (end < vaddr || end > USERSPACETOP) {
+		return ENOMEM;
+	}
+	result = as_check_range(as, vaddr, end);
+	if (result) {
+		return result;
+	}
+
+	for (; vaddr < end; vaddr = rgend) {
+		rg = as_find_region(as, vaddr);
+		KASSERT(rg != NULL);
+		rgend = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		if (rgend > end) {
+			rgend = end;
+		}
+
+		switch (advice) {
+		    case MADV_NORMAL:
+		    case MADV_RANDOM:
+		    case MADV_SEQUENTIAL:
+			rg->rg_advice = advice;
+			break;
+		    case MADV_WILLNEED:
+			/* Only a hint; stop when memory runs short. */
+			for (va = vaddr; va < rgend; va += PAGE_SIZE) {
+				if (vm_prefault(as, va)) {
+					return 0;
+				}
+			}
+			break;
+		    case MADV_DONTNEED:
+			/* Shared pages are only lost once the file has them. */
+			if (rg->rg_mmap == MAP_SHARED) {
+				for (va = vaddr; va < rgend; va += PAGE_SIZE) {
+					result = as_syncpage(as, rg, va, true);
+					if (result) {
+						return result;
+					}
+				}
+			}
+			as_unmap_range(as, vaddr, (rgend - vaddr) / PAGE_SIZE);
+			break;
+		    case MADV_FREE:
+			/* File pages would come back from the file instead. */
+			if (rg->rg_vnode == NULL) {
+				as_free_range(as, vaddr,
+					      (rgend - vaddr) / PAGE_SIZE);
+			}
+			break;
+		    default:
+			return EINVAL;
+		}
+	}
+	return 0;
+}
+
+int
+as_mincore(struct addrspace *as, vaddr_t vaddr, size_t npages,
+	   unsigned char *vec)
+{
+	pte_t *pte;
+	size_t i;
+	int result;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	if (vaddr + npages * PAGE_SIZE < vaddr ||
+	    vaddr + npages * PAGE_SIZE > USERSPACETOP) {
+		return ENOMEM;
+	}
+	result = as_check_range(as, vaddr, vaddr + npages * PAGE_SIZE);
+	if (result) {
+		return result;
+	}
+
+	for (i = 0; i < npages; i++, vaddr += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, vaddr, false);
+		vec[i] = (pte != NULL && (*pte & PTE_VALID)) ?
+			MINCORE_INCORE : 0;
+	}
 	return 0;
 }
 
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
+	struct region *rg;
+	vaddr_t limit, end;
+	unsigned i;
+
 	/*
-	 * Write this.
+	 * Set aside room to grow, short of anything that's already
+	 * there. The heap is still empty at this point.
 	 */
-	struct page *p;
-	
-	for(int i = 0; i < DUMBVM_STACKPAGES; i++){
-		p = kmalloc(sizeof(struct page));
-		p->vaddr = USERSTACK - i * PAGE_SIZE;
-		p->perms = 0x7;
-		p->valid = 0;
-		array_add(as->ptable, p, NULL);
-	}
- 
-//	KASSERT(as->as_stackpbase != 0);
+	limit = USERSTACK - STACK_MAXPAGES * PAGE_SIZE;
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		end = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		if (end + STACK_GUARDPAGES * PAGE_SIZE > limit) {
+			limit = end + STACK_GUARDPAGES * PAGE_SIZE;
+		}
+	}
+	if (limit >= USERSTACK) {
+		return ENOMEM;
+	}
+
+	as->as_stack.rg_vbase = USERSTACK - PAGE_SIZE;
+	as->as_stack.rg_npages = 1;
+	as->as_stacklimit = limit;
+
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
 	return 0;
 }
-
@@ -142,12 +142,79 @@ copycheck(const_userptr_t userptr, size_t len, size_t *stoplen)
 	return 0;
 }
 
+/*
+ * Word-at-a-time helpers.
+ *
+ * User buffers are rarely aligned the same way as memcpy wants (it
+ * requires both pointers *and* the length to be word multiples, or
+ * it copies by bytes), so copyin and copyout use copyblock below
+ * instead: if the two pointers are aligned the same way relative to
+ * a word, it copies bytes up to the first word boundary, then whole
+ * words, then the leftover bytes.
+ *
+ * For strings, HASZERO(w) is nonzero if and only if some byte of the
+ * word w is zero. (Subtracting 1 from each byte borrows into the top
+ * bit only for a byte that was zero, or that was 0x80 or more to
+ * begin with; masking with ~w rules out the latter.) This lets
+ * copystr scan a word at a time and only drop back to bytes for the
+ * word that holds the terminator.
+ *
+ * An aligned word never straddles a page boundary, and USERSPACETOP
+ * is page-aligned, so reading the whole of the word containing the
+ * terminator cannot fault where reading the string by bytes would
+ * not have.
+ */
+
+#define WORD_ONES	((unsigned long)-1 / 0xff)	/* 0x01010101 */
+#define WORD_HIGHS	(WORD_ONES * 0x80)		/* 0x80808080 */
+#define HASZERO(w)	(((w) - WORD_ONES) & ~(w) & WORD_HIGHS)
+
+#define WORDOFF(p)	((uintptr_t)(p) % sizeof(unsigned long))
+
+static
+void
+copyblock(void *dest, const void *src, size_t len)
+{
+	char *d = dest;
+	const char *s = src;
+	unsigned long *dw;
+	const unsigned long *sw;
+
+	if (len >= 4 * sizeof(unsigned long) && WORDOFF(d) == WORDOFF(s)) {
+		while (WORDOFF(d) != 0) {
+			*d++ = *s++;
+			len--;
+		}
+		dw = (unsigned long *)d;
+		sw = (const unsigned long *)s;
+		while (len >= 4 * sizeof(unsigned long)) {
+			dw[0] = sw[0];
+			dw[1] = sw[1];
+			dw[2] = sw[2];
+			dw[3] = sw[3];
+			dw += 4;
+			sw += 4;
+			len -= 4 * sizeof(unsigned long);
+		}
+		while (len >= sizeof(unsigned long)) {
+			*dw++ = *sw++;
+			len -= sizeof(unsigned long);
+		}
+		d = (char *)dw;
+		s = (const char *)sw;
+	}
+	while (len > 0) {
+		*d++ = *s++;
+		len--;
+	}
+}
+
 /*
  * copyin
  *
  * Copy a block of memory of length LEN from user-level address USERSRC
- * to kernel address DEST. We can use memcpy because it's protected by
- * the tm_badfaultfunc/copyfail logic.
+ * to kernel address DEST. We can copy with ordinary loads and stores
+ * because it's protected by the tm_badfaultfunc/copyfail logic.
  */
 int
 copyin(const_userptr_t usersrc, void *dest, size_t len)
@@ -172,7 +239,7 @@ copyin(const_userptr_t usersrc, void *dest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy(dest, (const void *)usersrc, len);
+	copyblock(dest, (const void *)usersrc, len);
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return 0;
@@ -182,8 +249,8 @@ copyin(const_userptr_t usersrc, void *dest, size_t len)
  * copyout
  *
  * Copy a block of memory of length LEN from kernel address SRC to
- * user-level address USERDEST. We can use memcpy because it's
- * protected by the tm_badfaultfunc/copyfail logic.
+ * user-level address USERDEST. As with copyin, this is protected by
+ * the tm_badfaultfunc/copyfail logic.
  */
 int
 copyout(const void *src, userptr_t userdest, size_t len)
@@ -208,7 +275,7 @@ copyout(const void *src, userptr_t userdest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy((void *)userdest, src, len);
+	copyblock((void *)userdest, src, len);
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return 0;
@@ -229,15 +296,44 @@ copyout(const void *src, userptr_t userdest, size_t len)
  * hit STOPLEN it's because the string has run into the end of
  * userspace. Thus in the latter case we return EFAULT, not
  * ENAMETOOLONG.
+ *
+ * When SRC and DEST are aligned the same way, whole words are checked
+ * with HASZERO and copied as long as they fit within both limits;
+ * the word with the terminator in it, and anything left over at
+ * either end, go through the byte loop.
  */
 static
 int
 copystr(char *dest, const char *src, size_t maxlen, size_t stoplen,
 	size_t *gotlen)
 {
-	size_t i;
+	size_t i, limit;
+	unsigned long w;
+
+	limit = maxlen < stoplen ? maxlen : stoplen;
+	i = 0;
+
+	if (WORDOFF(dest) == WORDOFF(src)) {
+		for (; i<limit && WORDOFF(src+i) != 0; i++) {
+			dest[i] = src[i];
+			if (src[i] == 0) {
+				if (gotlen != NULL) {
+					*gotlen = i+1;
+				}
+				return 0;
+			}
+		}
+		while (i + sizeof(unsigned long) <= limit) {
+			w = *(const unsigned long *)(src+i);
+			if (HASZERO(w)) {
+				break;
+			}
+			*(unsigned long *)(dest+i) = w;
+			i += sizeof(unsigned long);
+		}
+	}
 
-	for (i=0; i<maxlen && i<stoplen; i++) {
+	for (; i<maxlen && i<stoplen; i++) {
 		dest[i] = src[i];
 		if (src[i] == 0) {
 			if (gotlen != NULL) {
@@ -0,0 +1,1421 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Physical page (frame) allocator and pager.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <swap.h>
+#include <coremap.h>
+#include <vmstat.h>
+
+/*
+ * The coremap proper. It lives in memory stolen from ram_stealmem
+ * before the coremap takes over, so it is itself covered by the
+ * fixed region at the bottom of the table.
+ */
+static struct coremap_entry *coremap;
+static unsigned coremap_npages;		/* entries in coremap[] */
+static unsigned coremap_firstpage;	/* first frame we manage */
+static unsigned coremap_nused;		/* managed frames in use */
+static unsigned coremap_clockhand;	/* next eviction candidate */
+static volatile bool coremap_ready = false;
+
+volatile uint8_t *coremap_refbits;
+
+/*
+ * Free frames are kept by a buddy allocator: in blocks of 2^order
+ * frames, each aligned to its size in absolute frame numbers, on one
+ * list per order. The first entry of a free block has freehead set
+ * and records the order; the lists are linked through fl_next and
+ * fl_prev by frame index, with 0 (never a managed frame; it holds the
+ * exception handlers) ending them.
+ */
+#define COREMAP_MAXORDER	16
+static unsigned coremap_freelist[COREMAP_MAXORDER + 1];
+static unsigned coremap_nfreeblocks[COREMAP_MAXORDER + 1];
+
+/*
+ * Frames zeroed ahead of time by idle CPUs, for pages that have to
+ * start out zero-filled. They are allocated to the pool (valid and
+ * busy, with no references) so nobody else touches them; ordinary
+ * allocations take them back when nothing else is free.
+ */
+#define ZEROPOOL_MAX	32
+static unsigned coremap_zeropool[ZEROPOOL_MAX];
+static unsigned coremap_nzeropool;	/* frames in the pool */
+static unsigned coremap_nzeroing;	/* frames being zeroed for it */
+static unsigned coremap_nzerofill;	/* frames zeroed by idle CPUs */
+
+/*
+ * Per-CPU caches of free frames, so single-page allocations and frees
+ * don't all queue up on coremap_lock. Frames move between a cache and
+ * the buddy lists in batches: a CPU whose cache is empty refills it
+ * with COREMAP_PCPU_LOW frames, and one whose cache is full (at
+ * COREMAP_PCPU_HIGH) gives back all but COREMAP_PCPU_LOW. Cached
+ * frames look like those in the zero pool: allocated and busy, with
+ * no references, and counted as used.
+ *
+ * Each cache has its own lock, taken before coremap_lock when both
+ * are needed. A thread that moves to another CPU while it's using a
+ * cache just ends up using that CPU's cache, which is harmless.
+ */
+#define COREMAP_PCPU_LOW	8
+#define COREMAP_PCPU_HIGH	24
+
+struct coremap_pcpu {
+	struct spinlock cp_lock;
+	unsigned cp_frames[COREMAP_PCPU_HIGH];
+	unsigned cp_num;		/* frames in the cache */
+	unsigned cp_nalloc;		/* allocations served */
+	unsigned cp_nfree;		/* frees taken */
+	unsigned cp_nrefill;		/* batches from the buddy lists */
+	unsigned cp_ndrain;		/* ...and back */
+};
+static struct coremap_pcpu coremap_pcpu[MAXCPUS];
+
+/*
+ * One lock for the coremap. Before the coremap is ready it also
+ * protects ram_stealmem. Threads waiting for a busy frame sleep on
+ * coremap_wchan.
+ */
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+static struct wchan *coremap_wchan;
+
+#define PADDR_TO_CMINDEX(pa)	((pa) / PAGE_SIZE)
+#define CMINDEX_TO_PADDR(i)	((paddr_t)(i) * PAGE_SIZE)
+
+/*
+ * Reset an entry to the free state.
+ */
+static
+void
+coremap_clear(struct coremap_entry *cme)
+{
+	cme->as = NULL;
+	cme->vaddr = 0;
+	cme->block_len = -1;
+	cme->refcount = 0;
+	cme->swapslot = COREMAP_NOSLOT;
+	cme->valid = 0;
+	cme->busy = 0;
+	cme->dirty = 0;
+	cme->freehead = 0;
+	cme->order = 0;
+	cme->fl_next = 0;
+	cme->fl_prev = 0;
+	cme->kmtag = 0;
+	cme->kmsize = 0;
+	coremap_refbits[cme - coremap] = 0;
+}
+
+////////////////////////////////////////////////////////////
+// Buddy free lists
+//
+// All of these are called with the coremap lock held (or, in
+// init_coremap, before anyone else can look).
+
+static
+void
+coremap_flink(unsigned i, unsigned order)
+{
+	struct coremap_entry *cme = &coremap[i];
+
+	KASSERT(!cme->valid && !cme->freehead);
+	cme->freehead = 1;
+	cme->order = order;
+	cme->fl_prev = 0;
+	cme->fl_next = coremap_freelist[order];
+	if (cme->fl_next != 0) {
+		coremap[cme->fl_next].fl_prev = i;
+	}
+	coremap_freelist[order] = i;
+	coremap_nfreeblocks[order]++;
+}
+
+static
+void
+coremap_funlink(unsigned i)
+{
+	struct coremap_entry *cme = &coremap[i];
+
+	KASSERT(cme->freehead);
+	if (cme->fl_prev != 0) {
+		coremap[cme->fl_prev].fl_next = cme->fl_next;
+	}
+	else {
+		coremap_freelist[cme->order] = cme->fl_next;
+	}
+	if (cme->fl_next != 0) {
+		coremap[cme->fl_next].fl_prev = cme->fl_prev;
+	}
+	coremap_nfreeblocks[cme->order]--;
+	cme->freehead = 0;
+	cme->fl_next = 0;
+	cme->fl_prev = 0;
+}
+
+/*
+ * Free the block of 2^ORDER frames at I, merging it with its buddy
+ * for as long as the buddy is free too.
+ */
+static
+void
+coremap_freeblock(unsigned i, unsigned order)
+{
+	unsigned buddy;
+
+	KASSERT((i & ((1U << order) - 1)) == 0);
+
+	while (order < COREMAP_MAXORDER) {
+		buddy = i ^ (1U << order);
+		if (buddy >= coremap_npages || !coremap[buddy].freehead ||
+		    coremap[buddy].order != order) {
+			break;
+		}
+		coremap_funlink(buddy);
+		i &= ~(1U << order);
+		order++;
+	}
+	coremap_flink(i, order);
+}
+
+/*
+ * Free NPAGES frames starting at BASE, as the largest aligned blocks
+ * that fit.
+ */
+static
+void
+coremap_freerange(unsigned base, unsigned long npages)
+{
+	unsigned order;
+
+	while (npages > 0) {
+		order = 0;
+		while (order < COREMAP_MAXORDER &&
+		       (base & ((2U << order) - 1)) == 0 &&
+		       (2UL << order) <= npages) {
+			order++;
+		}
+		coremap_freeblock(base, order);
+		base += 1U << order;
+		npages -= 1UL << order;
+	}
+}
+
+/*
+ * Take a free block of 2^ORDER frames, splitting a bigger one if
+ * need be. Returns its first frame, or 0 if there's none.
+ */
+static
+unsigned
+coremap_takeblock(unsigned order)
+{
+	unsigned o, i;
+
+	for (o = order; o <= COREMAP_MAXORDER; o++) {
+		if (coremap_freelist[o] != 0) {
+			break;
+		}
+	}
+	if (o > COREMAP_MAXORDER) {
+		return 0;
+	}
+	i = coremap_freelist[o];
+	coremap_funlink(i);
+	while (o > order) {
+		o--;
+		coremap_flink(i + (1U << o), o);
+	}
+	return i;
+}
+
+/*
+ * Take the particular free frame I out of whatever block it's in,
+ * giving back the rest of the block.
+ */
+static
+void
+coremap_takeframe(unsigned i)
+{
+	unsigned o, head, half;
+
+	KASSERT(!coremap[i].valid);
+
+	/* Find the free block holding it. */
+	for (o = 0; o <= COREMAP_MAXORDER; o++) {
+		head = i & ~((1U << o) - 1);
+		if (coremap[head].freehead && coremap[head].order >= o) {
+			break;
+		}
+	}
+	KASSERT(o <= COREMAP_MAXORDER);
+
+	o = coremap[head].order;
+	coremap_funlink(head);
+	while (o > 0) {
+		o--;
+		half = head + (1U << o);
+		if (i >= half) {
+			coremap_flink(head, o);
+			head = half;
+		}
+		else {
+			coremap_flink(half, o);
+		}
+	}
+	KASSERT(head == i);
+}
+
+void
+init_coremap(void)
+{
+	uint32_t firstpaddr, lastpaddr;
+	size_t coremap_bytes;
+	paddr_t coremap_paddr;
+	unsigned i;
+
+	ram_getsize(&firstpaddr, &lastpaddr);
+
+	coremap_npages = lastpaddr / PAGE_SIZE;
+	coremap_bytes = coremap_npages * sizeof(struct coremap_entry);
+
+	coremap_paddr = ram_stealmem(DIVROUNDUP(coremap_bytes, PAGE_SIZE));
+	if (coremap_paddr == 0) {
+		panic("init_coremap: no memory for the coremap\n");
+	}
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(coremap_paddr);
+
+	coremap_paddr = ram_stealmem(DIVROUNDUP(coremap_npages, PAGE_SIZE));
+	if (coremap_paddr == 0) {
+		panic("init_coremap: no memory for the coremap\n");
+	}
+	coremap_refbits = (uint8_t *)PADDR_TO_KVADDR(coremap_paddr);
+
+	/* Still comes from ram_stealmem, so do it before we count. */
+	coremap_wchan = wchan_create("coremap");
+	if (coremap_wchan == NULL) {
+		panic("init_coremap: cannot create wchan\n");
+	}
+
+	/* Everything ram_stealmem has handed out stays allocated. */
+	firstpaddr = ram_getfirstfree();
+	coremap_firstpage = PADDR_TO_CMINDEX(firstpaddr);
+
+	for (i = 0; i < coremap_npages; i++) {
+		coremap_clear(&coremap[i]);
+		coremap[i].valid = i < coremap_firstpage;
+	}
+	for (i = 0; i <= COREMAP_MAXORDER; i++) {
+		coremap_freelist[i] = 0;
+		coremap_nfreeblocks[i] = 0;
+	}
+	coremap_freerange(coremap_firstpage,
+			  coremap_npages - coremap_firstpage);
+
+	for (i = 0; i < MAXCPUS; i++) {
+		spinlock_init(&coremap_pcpu[i].cp_lock);
+		coremap_pcpu[i].cp_num = 0;
+	}
+
+	coremap_nused = 0;
+	coremap_nzeropool = 0;
+	coremap_nzeroing = 0;
+	coremap_clockhand = coremap_firstpage;
+
+	DEBUG(DB_VM, "coremap: managing %u pages at 0x%x\n",
+	      coremap_npages - coremap_firstpage, firstpaddr);
+
+	spinlock_acquire(&coremap_lock);
+	coremap_ready = true;
+	spinlock_release(&coremap_lock);
+}
+
+bool
+coremap_isready(void)
+{
+	return coremap_ready;
+}
+
+////////////////////////////////////////////////////////////
+// Eviction
+
+/*
+ * Can this frame be paged out? It has to be an unshared user page
+ * that nobody is working on. Dirty pages need somewhere to go.
+ */
+static
+bool
+coremap_evictable(struct coremap_entry *cme)
+{
+	return cme->valid && cme->as != NULL && !cme->busy &&
+		cme->block_len == 1 && cme->refcount == 1 &&
+		(!cme->dirty || swap_enabled());
+}
+
+/*
+ * Pick a victim with the clock (second-chance) algorithm: sweep the
+ * hand over the frames, clearing referenced bits, and take the first
+ * candidate found with its bit already clear. Two sweeps are enough
+ * to find one if any exists. Returns 0 if there's nothing to evict.
+ */
+static
+unsigned
+coremap_clock(void)
+{
+	unsigned n, i, nmanaged;
+
+	nmanaged = coremap_npages - coremap_firstpage;
+	for (n = 0; n < 2 * nmanaged; n++) {
+		i = coremap_clockhand++;
+		if (coremap_clockhand >= coremap_npages) {
+			coremap_clockhand = coremap_firstpage;
+		}
+		if (!coremap_evictable(&coremap[i])) {
+			continue;
+		}
+		if (coremap_refbits[i]) {
+			coremap_refbits[i] = 0;
+			continue;
+		}
+		return i;
+	}
+	return 0;
+}
+
+/*
+ * Page out frame I, which the caller has marked busy.
+ *
+ * The page table entry is first marked in transit, so faults on the
+ * page wait for us, and every TLB is purged of the page. Then, if the
+ * page is dirty, it is written to swap. Finally the PTE is pointed at
+ * wherever the page now lives: its swap slot, or nowhere (clean pages
+ * with no copy in swap are read back from their file, or zero-filled).
+ *
+ * On success the frame is left allocated and busy, belonging to
+ * nobody, for the caller to reuse. Called and returns with the
+ * coremap lock held; drops it in between.
+ */
+static
+int
+coremap_evict(unsigned i)
+{
+	struct coremap_entry *cme = &coremap[i];
+	struct addrspace *as;
+	paddr_t pa;
+	vaddr_t va;
+	pte_t *pte, newpte;
+	unsigned slot;
+	bool dirty;
+	int result;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(cme->busy);
+
+	as = cme->as;
+	va = cme->vaddr;
+	pa = CMINDEX_TO_PADDR(i);
+	slot = cme->swapslot;
+	dirty = cme->dirty;
+
+	pte = pt_lookup(as->as_pt, va, false);
+	KASSERT(pte != NULL);
+	KASSERT((*pte & PTE_VALID) && (*pte & PTE_FRAME) == pa);
+	*pte = pa | PTE_INTRANSIT;
+
+	spinlock_release(&coremap_lock);
+
+	vm_tlbshootdown_page(as, va);
+
+	result = 0;
+	if (dirty) {
+		KASSERT(slot == COREMAP_NOSLOT);
+		result = swap_alloc(&slot);
+		if (result == 0) {
+			result = swap_out(slot, pa);
+			if (result) {
+				swap_free(slot);
+			}
+		}
+	}
+
+	spinlock_acquire(&coremap_lock);
+
+	if (result) {
+		/*
+		 * Put the page back. It's mapped read-only; the
+		 * next write faults and turns PTE_WRITE back on.
+		 */
+		*pte = pa | PTE_VALID;
+		cme->busy = 0;
+		wchan_wakeall(coremap_wchan, &coremap_lock);
+		return result;
+	}
+
+	newpte = (slot == COREMAP_NOSLOT) ? 0 : PTE_MKSWAP(slot);
+	*pte = newpte;
+
+	vmstat_inc(VS_EVICTIONS);
+	if (dirty) {
+		vmstat_inc(VS_SWAPOUTS);
+	}
+
+	cme->as = NULL;
+	cme->vaddr = 0;
+	cme->block_len = -1;
+	cme->refcount = 0;
+	cme->swapslot = COREMAP_NOSLOT;
+	cme->dirty = 0;
+	coremap_refbits[i] = 0;
+	wchan_wakeall(coremap_wchan, &coremap_lock);
+
+	return 0;
+}
+
+/*
+ * Make room for NPAGES contiguous frames by paging things out.
+ * Returns the index of the first frame, with the frames marked valid
+ * and busy but otherwise blank, or 0 on failure. Called with the
+ * coremap lock held.
+ */
+static
+unsigned
+coremap_reclaim(unsigned long npages)
+{
+	unsigned base, i, count, evicted;
+
+	if (npages == 1) {
+		i = coremap_clock();
+		if (i == 0) {
+			return 0;
+		}
+		coremap[i].busy = 1;
+		if (coremap_evict(i)) {
+			return 0;
+		}
+		return i;
+	}
+
+	/*
+	 * Several pages: find a window in which every frame is either
+	 * free or could be evicted. This ignores the referenced bits;
+	 * multi-page allocations are rare and finding any window at
+	 * all is the hard part.
+	 */
+	base = 0;
+	count = 0;
+	for (i = coremap_firstpage; i < coremap_npages; i++) {
+		if (coremap[i].valid && !coremap_evictable(&coremap[i])) {
+			count = 0;
+			continue;
+		}
+		count++;
+		if (count == npages) {
+			base = i - npages + 1;
+			break;
+		}
+	}
+	if (base == 0) {
+		return 0;
+	}
+
+	/* Claim the whole window before we start dropping the lock. */
+	for (i = base; i < base + npages; i++) {
+		if (!coremap[i].valid) {
+			coremap_takeframe(i);
+			coremap[i].valid = 1;
+			coremap_nused++;
+		}
+		coremap[i].busy = 1;
+	}
+
+	for (i = base; i < base + npages; i++) {
+		if (coremap[i].as == NULL) {
+			continue;
+		}
+		if (coremap_evict(i)) {
+			break;
+		}
+	}
+	if (i == base + npages) {
+		return base;
+	}
+
+	/*
+	 * Couldn't get one of them out. Give back what we took:
+	 * frames up to I are now empty, the rest still hold pages.
+	 */
+	evicted = i;
+	for (i = base; i < base + npages; i++) {
+		if (i < evicted || coremap[i].as == NULL) {
+			coremap_clear(&coremap[i]);
+			coremap_freeblock(i, 0);
+			coremap_nused--;
+		}
+		else {
+			coremap[i].busy = 0;
+		}
+	}
+	wchan_wakeall(coremap_wchan, &coremap_lock);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// Allocation
+
+/*
+ * Take NPAGES free frames if there are any, marking them allocated:
+ * split off the smallest free block that holds them and give back
+ * the tail. Returns the index of the first, or 0. Called with the
+ * coremap lock held.
+ */
+static
+unsigned
+coremap_claimrun(unsigned long npages)
+{
+	unsigned base, i, order;
+
+	if (npages > coremap_npages - coremap_firstpage - coremap_nused) {
+		return 0;
+	}
+
+	order = 0;
+	while ((1UL << order) < npages) {
+		order++;
+	}
+	if (order > COREMAP_MAXORDER) {
+		return 0;
+	}
+	base = coremap_takeblock(order);
+	if (base == 0) {
+		return 0;
+	}
+	/* Give back the part of the block we don't need. */
+	coremap_freerange(base + npages, (1UL << order) - npages);
+
+	for (i = base; i < base + npages; i++) {
+		KASSERT(coremap[i].valid == 0);
+		KASSERT(coremap[i].block_len == -1);
+		coremap[i].valid = 1;
+	}
+	coremap_nused += npages;
+	return base;
+}
+
+/*
+ * Give the frames in the zero pool back to the free list. Called with
+ * the coremap lock held.
+ */
+static
+void
+coremap_zeropool_drain(void)
+{
+	unsigned i;
+
+	while (coremap_nzeropool > 0) {
+		i = coremap_zeropool[--coremap_nzeropool];
+		coremap_clear(&coremap[i]);
+		coremap_freeblock(i, 0);
+		coremap_nused--;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Per-CPU frame caches
+
+/*
+ * Turn a free entry, just taken off the buddy lists, into a cached
+ * one. Call with coremap_lock held.
+ */
+static
+void
+coremap_pcpu_prep(struct coremap_entry *cme)
+{
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	coremap_clear(cme);
+	cme->valid = 1;
+	cme->busy = 1;
+	cme->block_len = 1;
+}
+
+/*
+ * Turn an allocated single frame, which nobody else can be looking at,
+ * into a cached one without taking coremap_lock. It stays valid and
+ * busy throughout, so scans under the lock (e.g. coremap_reclaim)
+ * never mistake it for a free frame in the meantime.
+ */
+static
+void
+coremap_pcpu_recycle(struct coremap_entry *cme)
+{
+	KASSERT(cme->valid);
+	KASSERT(cme->block_len == 1);
+
+	/* Kernel pages aren't pinned; user pages already are. */
+	cme->busy = 1;
+	cme->as = NULL;
+	cme->vaddr = 0;
+	cme->refcount = 0;
+	cme->swapslot = COREMAP_NOSLOT;
+	cme->dirty = 0;
+	cme->kmtag = 0;
+	cme->kmsize = 0;
+	coremap_refbits[cme - coremap] = 0;
+}
+
+/*
+ * Give frames in CP back to the buddy lists until only KEEP are left.
+ * Call with CP's lock held.
+ */
+static
+void
+coremap_pcpu_drain(struct coremap_pcpu *cp, unsigned keep)
+{
+	unsigned i;
+
+	spinlock_acquire(&coremap_lock);
+	while (cp->cp_num > keep) {
+		i = cp->cp_frames[--cp->cp_num];
+		coremap_clear(&coremap[i]);
+		coremap_freeblock(i, 0);
+		coremap_nused--;
+	}
+	spinlock_release(&coremap_lock);
+	cp->cp_ndrain++;
+}
+
+/*
+ * Take a frame from this CPU's cache, refilling it if it's empty.
+ * Returns its index, or 0 if there are no free frames to be had.
+ */
+static
+unsigned
+coremap_pcpu_get(void)
+{
+	struct coremap_pcpu *cp;
+	unsigned i;
+
+	cp = &coremap_pcpu[curcpu->c_number];
+	spinlock_acquire(&cp->cp_lock);
+	if (cp->cp_num == 0) {
+		spinlock_acquire(&coremap_lock);
+		while (cp->cp_num < COREMAP_PCPU_LOW) {
+			i = coremap_claimrun(1);
+			if (i == 0) {
+				break;
+			}
+			coremap_pcpu_prep(&coremap[i]);
+			cp->cp_frames[cp->cp_num++] = i;
+		}
+		spinlock_release(&coremap_lock);
+		cp->cp_nrefill++;
+		if (cp->cp_num == 0) {
+			spinlock_release(&cp->cp_lock);
+			return 0;
+		}
+	}
+	i = cp->cp_frames[--cp->cp_num];
+	cp->cp_nalloc++;
+	spinlock_release(&cp->cp_lock);
+	return i;
+}
+
+/*
+ * Put frame I, which nobody else can be looking at, in this CPU's
+ * cache, first making room if it's full.
+ */
+static
+void
+coremap_pcpu_put(unsigned i)
+{
+	struct coremap_pcpu *cp;
+
+	coremap_pcpu_recycle(&coremap[i]);
+
+	cp = &coremap_pcpu[curcpu->c_number];
+	spinlock_acquire(&cp->cp_lock);
+	if (cp->cp_num == COREMAP_PCPU_HIGH) {
+		coremap_pcpu_drain(cp, COREMAP_PCPU_LOW);
+	}
+	cp->cp_frames[cp->cp_num++] = i;
+	cp->cp_nfree++;
+	spinlock_release(&cp->cp_lock);
+}
+
+/*
+ * Empty every CPU's cache, for when memory runs short.
+ */
+static
+void
+coremap_pcpu_drainall(void)
+{
+	struct coremap_pcpu *cp;
+	unsigned i;
+
+	for (i = 0; i < MAXCPUS; i++) {
+		cp = &coremap_pcpu[i];
+		spinlock_acquire(&cp->cp_lock);
+		if (cp->cp_num > 0) {
+			coremap_pcpu_drain(cp, 0);
+		}
+		spinlock_release(&cp->cp_lock);
+	}
+}
+
+/*
+ * Common code for coremap_alloc and coremap_alloc_upage. AS and VADDR
+ * are the owner of a user page, or NULL for kernel memory.
+ *
+ * Single frames come from this CPU's cache if possible. Nobody else
+ * can see a cached frame, so it's set up without coremap_lock.
+ */
+static
+paddr_t
+coremap_allocrun(unsigned long npages, struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_entry *cme;
+	paddr_t pa;
+	unsigned base, i;
+	bool canevict;
+
+	KASSERT(npages > 0);
+
+	if (npages == 1 && coremap_ready) {
+		base = coremap_pcpu_get();
+		if (base != 0) {
+			cme = &coremap[base];
+			KASSERT(cme->valid && cme->busy);
+			KASSERT(cme->block_len == 1 && cme->refcount == 0);
+			cme->refcount = 1;
+			if (as != NULL) {
+				cme->as = as;
+				cme->vaddr = vaddr;
+				coremap_refbits[base] = 1;
+			}
+			else {
+				cme->busy = 0;
+			}
+			vmstat_inc(VS_FRAMEALLOCS);
+			return CMINDEX_TO_PADDR(base);
+		}
+	}
+
+	/*
+	 * Evicting sleeps, so we can only do it if the caller could.
+	 * Check before taking the lock, which would spoil the test.
+	 */
+	canevict = curthread != NULL && !curthread->t_in_interrupt &&
+		curcpu->c_spinlocks == 0;
+
+	spinlock_acquire(&coremap_lock);
+
+	if (!coremap_ready) {
+		pa = ram_stealmem(npages);
+		spinlock_release(&coremap_lock);
+		return pa;
+	}
+
+	base = coremap_claimrun(npages);
+	if (base == 0 && coremap_nzeropool > 0) {
+		/* Zeroed frames are still cheaper than paging out. */
+		if (npages == 1) {
+			base = coremap_zeropool[--coremap_nzeropool];
+		}
+		else {
+			coremap_zeropool_drain();
+			base = coremap_claimrun(npages);
+		}
+	}
+	if (base == 0 && canevict) {
+		/* There may be free frames sitting in the caches. */
+		spinlock_release(&coremap_lock);
+		coremap_pcpu_drainall();
+		spinlock_acquire(&coremap_lock);
+		base = coremap_claimrun(npages);
+	}
+	if (base == 0 && canevict) {
+		base = coremap_reclaim(npages);
+	}
+	if (base == 0) {
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+
+	for (i = base; i < base + npages; i++) {
+		KASSERT(coremap[i].valid);
+		coremap[i].busy = 0;
+	}
+	coremap[base].block_len = npages;
+	coremap[base].refcount = 1;
+	if (as != NULL) {
+		KASSERT(npages == 1);
+		coremap[base].as = as;
+		coremap[base].vaddr = vaddr;
+		coremap[base].busy = 1;
+		coremap_refbits[base] = 1;
+	}
+
+	spinlock_release(&coremap_lock);
+
+	vmstat_add(VS_FRAMEALLOCS, npages);
+	return CMINDEX_TO_PADDR(base);
+}
+
+paddr_t
+coremap_alloc(unsigned long npages)
+{
+	return coremap_allocrun(npages, NULL, 0);
+}
+
+paddr_t
+coremap_alloc_upage(struct addrspace *as, vaddr_t vaddr)
+{
+	KASSERT(as != NULL);
+	return coremap_allocrun(1, as, vaddr);
+}
+
+paddr_t
+coremap_alloc_zupage(struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_entry *cme;
+	paddr_t pa;
+
+	KASSERT(as != NULL);
+
+	spinlock_acquire(&coremap_lock);
+	if (coremap_nzeropool > 0) {
+		cme = &coremap[coremap_zeropool[--coremap_nzeropool]];
+		KASSERT(cme->valid && cme->busy);
+		KASSERT(cme->block_len == 1 && cme->refcount == 0);
+		cme->refcount = 1;
+		cme->as = as;
+		cme->vaddr = vaddr;
+		coremap_refbits[cme - coremap] = 1;
+		vmstat_inc(VS_ZEROHITS);
+		vmstat_inc(VS_FRAMEALLOCS);
+		spinlock_release(&coremap_lock);
+		return CMINDEX_TO_PADDR(cme - coremap);
+	}
+	vmstat_inc(VS_ZEROMISSES);
+	spinlock_release(&coremap_lock);
+
+	pa = coremap_alloc_upage(as, vaddr);
+	if (pa != 0) {
+		bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+	}
+	return pa;
+}
+
+bool
+coremap_zerofill(void)
+{
+	struct coremap_entry *cme;
+	unsigned i;
+
+	spinlock_acquire(&coremap_lock);
+	if (!coremap_ready ||
+	    coremap_nzeropool + coremap_nzeroing >= ZEROPOOL_MAX) {
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+	i = coremap_claimrun(1);
+	if (i == 0) {
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+	cme = &coremap[i];
+	cme->block_len = 1;
+	cme->busy = 1;
+	coremap_nzeroing++;
+	spinlock_release(&coremap_lock);
+
+	bzero((void *)PADDR_TO_KVADDR(CMINDEX_TO_PADDR(i)), PAGE_SIZE);
+
+	spinlock_acquire(&coremap_lock);
+	coremap_nzeroing--;
+	coremap_zeropool[coremap_nzeropool++] = i;
+	coremap_nzerofill++;
+	spinlock_release(&coremap_lock);
+	return true;
+}
+
+void
+coremap_free(paddr_t paddr)
+{
+	unsigned base, i;
+	int len;
+
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	base = PADDR_TO_CMINDEX(paddr);
+
+	/* A single frame only its owner knows about can go in the cache. */
+	if (coremap_ready && base >= coremap_firstpage &&
+	    coremap[base].block_len == 1 && coremap[base].refcount == 1) {
+		KASSERT(coremap[base].valid);
+		KASSERT(coremap[base].swapslot == COREMAP_NOSLOT);
+		coremap_pcpu_put(base);
+		vmstat_inc(VS_FRAMEFREES);
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+
+	if (!coremap_ready || base < coremap_firstpage) {
+		/*
+		 * Memory from ram_stealmem during early boot. We
+		 * can't get it back; leak it.
+		 */
+		spinlock_release(&coremap_lock);
+		return;
+	}
+
+	KASSERT(base < coremap_npages);
+	len = coremap[base].block_len;
+	if (len <= 0) {
+		panic("coremap_free: 0x%x is not the start of a block\n",
+		      paddr);
+	}
+	KASSERT(base + len <= coremap_npages);
+
+	KASSERT(coremap[base].refcount > 0);
+	coremap[base].refcount--;
+	if (coremap[base].refcount > 0) {
+		/* Still shared. */
+		spinlock_release(&coremap_lock);
+		return;
+	}
+
+	KASSERT(coremap[base].swapslot == COREMAP_NOSLOT);
+	for (i = base; i < base + len; i++) {
+		KASSERT(coremap[i].valid);
+		coremap_clear(&coremap[i]);
+	}
+	coremap_freerange(base, len);
+	KASSERT(coremap_nused >= (unsigned)len);
+	coremap_nused -= len;
+
+	spinlock_release(&coremap_lock);
+
+	vmstat_add(VS_FRAMEFREES, len);
+}
+
+/*
+ * Find the coremap entry for the start of a run we manage. The
+ * coremap lock must be held.
+ */
+static
+struct coremap_entry *
+coremap_getrun(paddr_t paddr)
+{
+	unsigned base;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(coremap_ready);
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	base = PADDR_TO_CMINDEX(paddr);
+	KASSERT(base >= coremap_firstpage && base < coremap_npages);
+	KASSERT(coremap[base].valid && coremap[base].block_len > 0);
+	return &coremap[base];
+}
+
+void
+coremap_incref(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_getrun(paddr);
+	KASSERT(cme->refcount > 0);
+	cme->refcount++;
+	spinlock_release(&coremap_lock);
+}
+
+unsigned
+coremap_refcount(paddr_t paddr)
+{
+	unsigned ret;
+
+	spinlock_acquire(&coremap_lock);
+	ret = coremap_getrun(paddr)->refcount;
+	spinlock_release(&coremap_lock);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////
+// Kernel heap pages
+
+void
+coremap_setkmtag(paddr_t paddr, unsigned tag, size_t size)
+{
+	unsigned i;
+
+	KASSERT(tag != 0 && tag <= 0xff);
+
+	i = PADDR_TO_CMINDEX(paddr);
+	if (!coremap_ready || i < coremap_firstpage) {
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(i < coremap_npages);
+	KASSERT(coremap[i].valid && coremap[i].as == NULL);
+	coremap[i].kmtag = tag;
+	coremap[i].kmsize = size;
+	spinlock_release(&coremap_lock);
+}
+
+unsigned
+coremap_getkmtag(paddr_t paddr, size_t *size)
+{
+	unsigned i;
+
+	i = PADDR_TO_CMINDEX(paddr);
+	if (!coremap_ready || i < coremap_firstpage || i >= coremap_npages) {
+		return 0;
+	}
+	if (size != NULL) {
+		*size = coremap[i].kmsize;
+	}
+	return coremap[i].kmtag;
+}
+
+////////////////////////////////////////////////////////////
+// User pages
+
+void
+coremap_free_upage(paddr_t paddr, struct addrspace *as)
+{
+	struct coremap_entry *cme;
+
+	/*
+	 * If this is the last reference, the caller's page table entry
+	 * was the only way to the frame, so nobody else can be waiting
+	 * for it to be unpinned, and it can go in the cache. (While
+	 * it's pinned, nobody else can change the reference count.)
+	 */
+	cme = &coremap[PADDR_TO_CMINDEX(paddr)];
+	KASSERT(cme->valid && cme->busy);
+	if (cme->refcount == 1) {
+		KASSERT(cme->block_len == 1);
+		if (cme->swapslot != COREMAP_NOSLOT) {
+			swap_free(cme->swapslot);
+		}
+		coremap_pcpu_put(cme - coremap);
+		vmstat_inc(VS_FRAMEFREES);
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_getrun(paddr);
+	KASSERT(cme->busy);
+	KASSERT(cme->block_len == 1);
+	KASSERT(cme->refcount > 0);
+
+	cme->refcount--;
+	if (cme->refcount == 0) {
+		if (cme->swapslot != COREMAP_NOSLOT) {
+			swap_free(cme->swapslot);
+		}
+		coremap_clear(cme);
+		coremap_freeblock(cme - coremap, 0);
+		coremap_nused--;
+		vmstat_inc(VS_FRAMEFREES);
+	}
+	else {
+		if (cme->as == as) {
+			/* Whoever's left claims it on their next touch. */
+			cme->as = NULL;
+		}
+		cme->busy = 0;
+	}
+	wchan_wakeall(coremap_wchan, &coremap_lock);
+	spinlock_release(&coremap_lock);
+}
+
+bool
+coremap_pin(pte_t *pte)
+{
+	struct coremap_entry *cme;
+	pte_t entry;
+
+	spinlock_acquire(&coremap_lock);
+	while (1) {
+		entry = *pte;
+		if (entry & PTE_INTRANSIT) {
+			/* Being paged out; wait until it's gone. */
+			wchan_sleep(coremap_wchan, &coremap_lock);
+			continue;
+		}
+		if (!(entry & PTE_VALID)) {
+			spinlock_release(&coremap_lock);
+			return false;
+		}
+		cme = coremap_getrun(entry & PTE_FRAME);
+		if (cme->busy) {
+			wchan_sleep(coremap_wchan, &coremap_lock);
+			continue;
+		}
+		cme->busy = 1;
+		spinlock_release(&coremap_lock);
+		return true;
+	}
+}
+
+void
+coremap_unpin(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_getrun(paddr);
+	KASSERT(cme->busy);
+	cme->busy = 0;
+	wchan_wakeall(coremap_wchan, &coremap_lock);
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_touch(pte_t *pte, struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_entry *cme;
+	pte_t entry;
+
+	spinlock_acquire(&coremap_lock);
+	entry = *pte;
+	if (entry & PTE_VALID) {
+		cme = coremap_getrun(entry & PTE_FRAME);
+		coremap_refbits[cme - coremap] = 1;
+		if (cme->as == NULL && cme->refcount == 1) {
+			/* Formerly shared; it's ours alone now. */
+			cme->as = as;
+			cme->vaddr = vaddr;
+		}
+	}
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_setdirty(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_getrun(paddr);
+	KASSERT(cme->busy);
+	if (cme->refcount == 1) {
+		cme->as = as;
+		cme->vaddr = vaddr;
+	}
+	cme->dirty = 1;
+	coremap_refbits[cme - coremap] = 1;
+	if (cme->swapslot != COREMAP_NOSLOT) {
+		/* The copy in swap is about to go stale. */
+		swap_free(cme->swapslot);
+		cme->swapslot = COREMAP_NOSLOT;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_setclean(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_getrun(paddr);
+	KASSERT(cme->busy);
+	KASSERT(cme->swapslot == COREMAP_NOSLOT);
+	cme->dirty = 0;
+	spinlock_release(&coremap_lock);
+}
+
+bool
+coremap_isdirty(paddr_t paddr)
+{
+	bool ret;
+
+	spinlock_acquire(&coremap_lock);
+	ret = coremap_getrun(paddr)->dirty;
+	spinlock_release(&coremap_lock);
+	return ret;
+}
+
+void
+coremap_setswapslot(paddr_t paddr, unsigned slot)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_getrun(paddr);
+	KASSERT(cme->busy);
+	KASSERT(cme->swapslot == COREMAP_NOSLOT);
+	KASSERT(!cme->dirty);
+	cme->swapslot = slot;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_setdiscard(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = coremap_getrun(paddr);
+	KASSERT(cme->busy);
+	cme->dirty = 0;
+	if (cme->swapslot != COREMAP_NOSLOT) {
+		swap_free(cme->swapslot);
+		cme->swapslot = COREMAP_NOSLOT;
+	}
+	coremap_refbits[cme - coremap] = 0;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_deactivate(pte_t *pte)
+{
+	pte_t entry;
+
+	spinlock_acquire(&coremap_lock);
+	entry = *pte;
+	if (entry & PTE_VALID) {
+		coremap_refbits[coremap_getrun(entry & PTE_FRAME) - coremap] = 0;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+////////////////////////////////////////////////////////////
+// Stats
+
+void
+coremap_getstats(unsigned *nused, unsigned *nfree)
+{
+	spinlock_acquire(&coremap_lock);
+	*nused = coremap_nused;
+	*nfree = coremap_npages - coremap_firstpage - coremap_nused;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_printfrag(void)
+{
+	unsigned counts[COREMAP_MAXORDER + 1];
+	unsigned i, nfree, top;
+
+	if (!coremap_ready) {
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	for (i = 0; i <= COREMAP_MAXORDER; i++) {
+		counts[i] = coremap_nfreeblocks[i];
+	}
+	spinlock_release(&coremap_lock);
+
+	kprintf("Free frames by buddy block size:\n");
+	nfree = 0;
+	top = 0;
+	for (i = 0; i <= COREMAP_MAXORDER; i++) {
+		if (counts[i] == 0) {
+			continue;
+		}
+		kprintf("    %5u pages: %u blocks\n", 1U << i, counts[i]);
+		nfree += counts[i] << i;
+		top = i;
+	}
+	if (nfree == 0) {
+		kprintf("No free pages\n");
+		return;
+	}
+	/* Share of free memory not in blocks of the largest size. */
+	kprintf("%u pages free, largest block %u pages, "
+		"fragmentation %u%%\n", nfree, 1U << top,
+		100 - (counts[top] << top) * 100 / nfree);
+}
+
+void
+coremap_printstats(void)
+{
+	unsigned nused, nfree, npool, nfill;
+	unsigned swapused, swaptotal;
+	unsigned counts[VS_NCOUNTERS];
+	struct coremap_pcpu *cp;
+	unsigned i;
+
+	if (!coremap_ready) {
+		kprintf("coremap: not initialized yet\n");
+		return;
+	}
+	coremap_getstats(&nused, &nfree);
+	kprintf("coremap: %u pages (%uk) used, %u pages (%uk) free, "
+		"%u pages reserved at boot\n",
+		nused, nused * PAGE_SIZE / 1024,
+		nfree, nfree * PAGE_SIZE / 1024,
+		coremap_firstpage);
+
+	spinlock_acquire(&coremap_lock);
+	npool = coremap_nzeropool;
+	nfill = coremap_nzerofill;
+	spinlock_release(&coremap_lock);
+
+	vmstat_gettotals(counts);
+
+	kprintf("zero pool: %u pages ready; %u hits, %u misses; "
+		"%u pages zeroed while idle\n",
+		npool, counts[VS_ZEROHITS], counts[VS_ZEROMISSES], nfill);
+
+	for (i = 0; i < MAXCPUS; i++) {
+		cp = &coremap_pcpu[i];
+		if (cp->cp_nrefill == 0 && cp->cp_nfree == 0) {
+			continue;
+		}
+		kprintf("cpu%u: %u pages cached; %u allocs and %u frees "
+			"served, %u refills, %u drains\n", i, cp->cp_num,
+			cp->cp_nalloc, cp->cp_nfree, cp->cp_nrefill,
+			cp->cp_ndrain);
+	}
+
+	swap_getstats(&swapused, &swaptotal);
+	kprintf("swap: %u of %u slots used; %u pages evicted, "
+		"%u written to swap\n",
+		swapused, swaptotal, counts[VS_EVICTIONS],
+		counts[VS_SWAPOUTS]);
+}
@@ -30,7 +30,11 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
 #include <vm.h>
+#include <coremap.h>
+#include <clock.h>
 
 /*
  * Kernel malloc.
@@ -131,6 +135,15 @@ static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
 #define SMALLEST_SUBPAGE_SIZE 16
 #define LARGEST_SUBPAGE_SIZE 2048
 
+/* Per-CPU magazines hold up to this many blocks, or this many bytes. */
+#define KMAG_MAXBLOCKS 32
+#define KMAG_BYTES 4096
+
+/* 3K blocks come four to a run of three pages. */
+#define BIG3K_SIZE 3072
+#define BIG3K_NPAGES 3
+#define BIG3K_NBLOCKS 4
+
 #elif PAGE_SIZE == 8192
 #error "No support for 8k pages (yet?)"
 #else
@@ -160,13 +173,35 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for the pages and their pagerefs. Most kmalloc and
+ * kfree calls don't get this far, though; see the per-CPU magazines
+ * below.
+ *
+ * For kheap_printstats, count the times the allocation paths take the
+ * lock, the pagerefs they look at while holding it, and the blocks
+ * they move while holding it.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
+static unsigned kmalloc_nlocks;
+static unsigned kmalloc_nsteps;
+static unsigned kmalloc_nmoved;
+
+/* Per-CPU magazines and bigger allocations; see below. */
+static void kmag_drainall(void);
+static void kmag_printstats(void);
+static void big_printstats(void);
+
+/*
+ * Heap pages are tagged in the coremap with what's on them, so kfree
+ * can tell without searching: subpage pages with their block type
+ * plus one, the pages of a run of 3K blocks, and the first page of a
+ * large allocation, along with its size.
+ */
+#define KMTAG_SUBPAGE(blktype)	((blktype) + 1)
+#define KMTAG_ISSUBPAGE(tag)	((tag) >= 1 && (tag) <= NSIZES)
+#define KMTAG_BIG3K		0x40
+#define KMTAG_LARGE		0x41
 
 ////////////////////////////////////////
 
@@ -697,6 +732,378 @@ dump_subpages(unsigned generation)
 
 #endif /* LABELS */
 
+////////////////////////////////////////////////////////////
+//
+// Heap profiler.
+//
+//    This is the production cousin of LABELS: it needs no change to
+//    the heap layout, so it's always compiled in, and can be turned
+//    on and off from the menu. While it's on, kmalloc and kfree
+//    charge each allocation to its call site (the caller's PC, as
+//    with LABELS), and kheap_profreport prints the sites holding the
+//    most memory, along with what they've done since the last
+//    kheap_nextgeneration.
+//
+//    Two fixed-size tables, allocated when the profiler is turned on,
+//    do the work: one of call sites and one of live allocations, so
+//    kfree can find who to credit. Both are open-addressed with
+//    linear probing. Sites past the table's capacity share the
+//    overflow entry (PC 0); allocations that don't fit in the live
+//    table, or that were made while the profiler was off, are simply
+//    not seen at kfree time.
+//
+//    When it's off, the cost in kmalloc and kfree is one test of
+//    khprof_on.
+//
+
+#define KHPROF_SITESHIFT	8
+#define KHPROF_LIVESHIFT	12
+#define KHPROF_NSITES	(1U << KHPROF_SITESHIFT)
+#define KHPROF_NLIVE	(1U << KHPROF_LIVESHIFT)
+#define KHPROF_MAXTOP	32
+
+struct khprof_site {
+	vaddr_t ks_pc;			/* call site; 0 for overflow */
+	size_t ks_livebytes;		/* bytes allocated now */
+	unsigned ks_livecount;		/* allocations now */
+	unsigned ks_nalloc;		/* allocations ever */
+	unsigned ks_nfree;		/* frees ever */
+	size_t ks_genbytes;		/* ks_livebytes at last generation */
+	unsigned ks_genalloc;		/* ks_nalloc at last generation */
+};
+
+struct khprof_live {
+	vaddr_t kl_addr;		/* block; 0 if slot is empty */
+	size_t kl_size;
+	unsigned kl_site;
+};
+
+#define KHPROF_BYTES	(KHPROF_NSITES * sizeof(struct khprof_site) + \
+			 KHPROF_NLIVE * sizeof(struct khprof_live))
+#define KHPROF_NPAGES	DIVROUNDUP(KHPROF_BYTES, PAGE_SIZE)
+
+static struct spinlock khprof_spinlock = SPINLOCK_INITIALIZER;
+static volatile bool khprof_on;
+static struct khprof_site *khprof_sites;
+static struct khprof_live *khprof_live;
+static unsigned khprof_nsites;		/* sites in use */
+static unsigned khprof_nlive;		/* live slots in use */
+static unsigned khprof_nlost;		/* allocations not tracked */
+static struct timespec khprof_gentime;	/* time of last generation */
+
+/*
+ * Hash VAL into a table of 1 << SHIFT slots. Take the top bits of the
+ * product; the low ones are always zero for aligned addresses.
+ */
+static
+unsigned
+khprof_hash(vaddr_t val, unsigned shift)
+{
+	return ((uint32_t)val * 2654435761U) >> (32 - shift);
+}
+
+/*
+ * Find the site entry for PC, adding it if need be. Site 0 is the
+ * overflow entry.
+ */
+static
+unsigned
+khprof_getsite(vaddr_t pc)
+{
+	unsigned i, n;
+
+	KASSERT(spinlock_do_i_hold(&khprof_spinlock));
+
+	i = khprof_hash(pc, KHPROF_SITESHIFT);
+	for (n = 0; n < KHPROF_NSITES; n++) {
+		if (i != 0) {
+			if (khprof_sites[i].ks_pc == pc) {
+				return i;
+			}
+			if (khprof_sites[i].ks_pc == 0) {
+				khprof_sites[i].ks_pc = pc;
+				khprof_nsites++;
+				return i;
+			}
+		}
+		i = (i + 1) % KHPROF_NSITES;
+	}
+	return 0;
+}
+
+/*
+ * Record an allocation of SZ bytes at ADDR from PC.
+ */
+static
+void
+khprof_alloc(vaddr_t addr, size_t sz, vaddr_t pc)
+{
+	struct khprof_site *ks;
+	unsigned site, i;
+
+	spinlock_acquire(&khprof_spinlock);
+	if (khprof_sites == NULL) {
+		/* Turned off since we looked */
+		spinlock_release(&khprof_spinlock);
+		return;
+	}
+	site = khprof_getsite(pc);
+	ks = &khprof_sites[site];
+	ks->ks_nalloc++;
+
+	/* Keep one slot free so lookups always terminate. */
+	if (khprof_nlive >= KHPROF_NLIVE - 1) {
+		khprof_nlost++;
+		spinlock_release(&khprof_spinlock);
+		return;
+	}
+	i = khprof_hash(addr, KHPROF_LIVESHIFT);
+	while (khprof_live[i].kl_addr != 0) {
+		KASSERT(khprof_live[i].kl_addr != addr);
+		i = (i + 1) % KHPROF_NLIVE;
+	}
+	khprof_live[i].kl_addr = addr;
+	khprof_live[i].kl_size = sz;
+	khprof_live[i].kl_site = site;
+	khprof_nlive++;
+	ks->ks_livebytes += sz;
+	ks->ks_livecount++;
+	spinlock_release(&khprof_spinlock);
+}
+
+/*
+ * Credit the free of ADDR to its site, if we saw it allocated.
+ */
+static
+void
+khprof_free(vaddr_t addr)
+{
+	struct khprof_site *ks;
+	unsigned i, j, home;
+
+	spinlock_acquire(&khprof_spinlock);
+	if (khprof_live == NULL) {
+		spinlock_release(&khprof_spinlock);
+		return;
+	}
+	i = khprof_hash(addr, KHPROF_LIVESHIFT);
+	while (khprof_live[i].kl_addr != addr) {
+		if (khprof_live[i].kl_addr == 0) {
+			/* Not one of ours */
+			spinlock_release(&khprof_spinlock);
+			return;
+		}
+		i = (i + 1) % KHPROF_NLIVE;
+	}
+
+	ks = &khprof_sites[khprof_live[i].kl_site];
+	KASSERT(ks->ks_livecount > 0);
+	ks->ks_livebytes -= khprof_live[i].kl_size;
+	ks->ks_livecount--;
+	ks->ks_nfree++;
+	khprof_nlive--;
+
+	/*
+	 * Remove the slot by shifting back any later entries in the
+	 * same run that would no longer be found past the hole.
+	 */
+	j = i;
+	while (1) {
+		khprof_live[i].kl_addr = 0;
+		while (1) {
+			j = (j + 1) % KHPROF_NLIVE;
+			if (khprof_live[j].kl_addr == 0) {
+				spinlock_release(&khprof_spinlock);
+				return;
+			}
+			home = khprof_hash(khprof_live[j].kl_addr,
+					   KHPROF_LIVESHIFT);
+			/* Can J's entry stay put? Only if HOME is in (I, J]. */
+			if (i <= j ? (i < home && home <= j)
+				   : (i < home || home <= j)) {
+				continue;
+			}
+			break;
+		}
+		khprof_live[i] = khprof_live[j];
+		i = j;
+	}
+}
+
+/*
+ * Turn the profiler on or off. Turning it on starts from scratch.
+ */
+void
+kheap_profile(bool on)
+{
+	vaddr_t base, oldbase;
+
+	base = 0;
+	if (on) {
+		base = alloc_kpages(KHPROF_NPAGES);
+		if (base == 0) {
+			kprintf("kheap_profile: Out of memory\n");
+			return;
+		}
+		bzero((void *)base, KHPROF_NPAGES * PAGE_SIZE);
+	}
+
+	spinlock_acquire(&khprof_spinlock);
+	oldbase = (vaddr_t)khprof_sites;
+	khprof_sites = (struct khprof_site *)base;
+	khprof_live = base == 0 ? NULL :
+		(struct khprof_live *)(base +
+			KHPROF_NSITES * sizeof(struct khprof_site));
+	khprof_nsites = 0;
+	khprof_nlive = 0;
+	khprof_nlost = 0;
+	khprof_on = on;
+	spinlock_release(&khprof_spinlock);
+
+	if (on) {
+		gettime(&khprof_gentime);
+	}
+	if (oldbase != 0) {
+		free_kpages(oldbase);
+	}
+}
+
+/*
+ * Start a new generation: remember where each site is now, so the
+ * report can show what happened since.
+ */
+static
+void
+khprof_nextgeneration(void)
+{
+	unsigned i;
+
+	spinlock_acquire(&khprof_spinlock);
+	if (khprof_sites != NULL) {
+		for (i=0; i<KHPROF_NSITES; i++) {
+			khprof_sites[i].ks_genbytes =
+				khprof_sites[i].ks_livebytes;
+			khprof_sites[i].ks_genalloc =
+				khprof_sites[i].ks_nalloc;
+		}
+	}
+	spinlock_release(&khprof_spinlock);
+	gettime(&khprof_gentime);
+}
+
+/*
+ * Print the NTOP sites holding the most memory.
+ */
+void
+kheap_profreport(unsigned ntop)
+{
+	struct khprof_site *top;
+	struct timespec now, elapsed;
+	unsigned i, j, best, nfound, msecs;
+	size_t totbytes, bestbytes;
+	unsigned totcount, nsites, nlost;
+
+	if (ntop > KHPROF_MAXTOP) {
+		ntop = KHPROF_MAXTOP;
+	}
+
+	/* Too big for the stack */
+	top = kmalloc(KHPROF_MAXTOP * sizeof(*top));
+	if (top == NULL) {
+		kprintf("kheap_profreport: Out of memory\n");
+		return;
+	}
+
+	gettime(&now);
+	timespec_sub(&now, &khprof_gentime, &elapsed);
+	msecs = elapsed.tv_sec * 1000 + elapsed.tv_nsec / 1000000;
+
+	/* Copy out the top entries, and print them without the lock. */
+	spinlock_acquire(&khprof_spinlock);
+	if (khprof_sites == NULL) {
+		spinlock_release(&khprof_spinlock);
+		kfree(top);
+		kprintf("Heap profiler is off.\n");
+		return;
+	}
+	totbytes = 0;
+	totcount = 0;
+	for (i=0; i<KHPROF_NSITES; i++) {
+		totbytes += khprof_sites[i].ks_livebytes;
+		totcount += khprof_sites[i].ks_livecount;
+	}
+
+	/*
+	 * Pick sites in order of live bytes, ties going to the lower
+	 * index; each pass takes the biggest that comes after the one
+	 * before.
+	 */
+	nfound = 0;
+	bestbytes = 0;
+	best = 0;
+	for (j=0; j<ntop; j++) {
+		unsigned prev = best;
+		size_t prevbytes = bestbytes;
+
+		best = KHPROF_NSITES;
+		for (i=0; i<KHPROF_NSITES; i++) {
+			size_t bytes = khprof_sites[i].ks_livebytes;
+
+			if (khprof_sites[i].ks_nalloc == 0) {
+				continue;
+			}
+			if (j > 0 && (bytes > prevbytes ||
+				      (bytes == prevbytes && i <= prev))) {
+				/* already listed */
+				continue;
+			}
+			if (best == KHPROF_NSITES || bytes > bestbytes) {
+				best = i;
+				bestbytes = bytes;
+			}
+		}
+		if (best == KHPROF_NSITES) {
+			break;
+		}
+		top[nfound++] = khprof_sites[best];
+	}
+	nsites = khprof_nsites;
+	nlost = khprof_nlost;
+	spinlock_release(&khprof_spinlock);
+
+	kprintf("Heap profile: %lu bytes in %u allocations tracked, "
+		"%u sites, %u allocations untracked\n",
+		(unsigned long)totbytes, totcount, nsites, nlost);
+	kprintf("Since last generation: %u.%03u seconds\n",
+		msecs / 1000, msecs % 1000);
+	kprintf("%10s %9s %8s %10s %10s %8s\n", "site", "bytes", "blocks",
+		"gen bytes", "gen allocs", "allocs/s");
+	for (j=0; j<nfound; j++) {
+		unsigned genalloc;
+		size_t genbytes;
+		char gensign;
+
+		genalloc = top[j].ks_nalloc - top[j].ks_genalloc;
+		if (top[j].ks_livebytes >= top[j].ks_genbytes) {
+			genbytes = top[j].ks_livebytes - top[j].ks_genbytes;
+			gensign = '+';
+		}
+		else {
+			genbytes = top[j].ks_genbytes - top[j].ks_livebytes;
+			gensign = '-';
+		}
+
+		kprintf("%10p %9lu %8u %c%9lu %10u %8u\n",
+			(void *)top[j].ks_pc,
+			(unsigned long)top[j].ks_livebytes,
+			top[j].ks_livecount, gensign, (unsigned long)genbytes,
+			genalloc, msecs == 0 ? 0 :
+			(unsigned)((uint64_t)genalloc * 1000 / msecs));
+	}
+
+	kfree(top);
+}
+
 void
 kheap_nextgeneration(void)
 {
@@ -705,6 +1112,7 @@ kheap_nextgeneration(void)
 	mallocgeneration++;
 	spinlock_release(&kmalloc_spinlock);
 #endif
+	khprof_nextgeneration();
 }
 
 void
@@ -811,7 +1219,15 @@ kheap_printstats(void)
 		subpage_stats(pr);
 	}
 
+	kprintf("kmalloc_spinlock: %u acquisitions, %u pagerefs searched, "
+		"%u blocks moved\n", kmalloc_nlocks, kmalloc_nsteps,
+		kmalloc_nmoved);
+	big_printstats();
+
 	spinlock_release(&kmalloc_spinlock);
+
+	kmag_printstats();
+	coremap_printfrag();
 }
 
 ////////////////////////////////////////
@@ -867,47 +1283,21 @@ int blocktype(size_t clientsz)
 }
 
 /*
- * Allocate a block of size SZ, where SZ is not large enough to
- * warrant a whole-page allocation.
+ * Take a free block of type BLKTYPE off a page that has one. Returns
+ * its address, or 0 if all pages of that size are full. The caller
+ * must hold kmalloc_spinlock.
  */
 static
-void *
-subpage_kmalloc(size_t sz
-#ifdef LABELS
-		, vaddr_t label
-#endif
-	)
+vaddr_t
+subpage_getblock(unsigned blktype)
 {
-	unsigned blktype;	// index into sizes[] that we're using
 	struct pageref *pr;	// pageref for page we're allocating from
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
-	struct freelist *volatile fl;	// free list entry
-	void *retptr;		// our result
-
-	volatile int i;
-
-#ifdef GUARDS
-	size_t clientsz;
-#endif
-
-#ifdef GUARDS
-	clientsz = sz;
-	sz += GUARD_OVERHEAD;
-#endif
-#ifdef LABELS
-#ifdef GUARDS
-	/* Include the label in what GUARDS considers the client data. */
-	clientsz += LABEL_PTROFFSET;
-#endif
-	sz += LABEL_PTROFFSET;
-#endif
-	blktype = blocktype(sz);
-	sz = sizes[blktype];
-
-	spinlock_acquire(&kmalloc_spinlock);
+	struct freelist *fl;	// free list entry
+	vaddr_t block;		// our result
 
-	checksubpages();
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
 	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
 
@@ -915,47 +1305,56 @@ subpage_kmalloc(size_t sz
 		KASSERT(PR_BLOCKTYPE(pr) == blktype);
 		checksubpage(pr);
 
+		kmalloc_nsteps++;
 		if (pr->nfree > 0) {
+			break;
+		}
+	}
+	if (pr == NULL) {
+		return 0;
+	}
 
-		doalloc: /* comes here after getting a whole fresh page */
+	KASSERT(pr->freelist_offset < PAGE_SIZE);
+	prpage = PR_PAGEADDR(pr);
+	fla = prpage + pr->freelist_offset;
+	fl = (struct freelist *)fla;
 
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
+	block = fla;
+	fl = fl->next;
+	pr->nfree--;
 
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
+	if (fl != NULL) {
+		KASSERT(pr->nfree > 0);
+		fla = (vaddr_t)fl;
+		KASSERT(fla - prpage < PAGE_SIZE);
+		pr->freelist_offset = fla - prpage;
+	}
+	else {
+		KASSERT(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
+	}
 
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
-#ifdef GUARDS
-			retptr = establishguardband(retptr, clientsz, sz);
-#endif
-#ifdef LABELS
-			retptr = establishlabel(retptr, label);
-#endif
+	kmalloc_nmoved++;
+	return block;
+}
 
-			checksubpages();
+/*
+ * Make a new page of blocks of type BLKTYPE. Called with
+ * kmalloc_spinlock held; returns with it held, but drops it in
+ * between. Returns nonzero if out of memory.
+ */
+static
+int
+subpage_newpage(unsigned blktype)
+{
+	struct pageref *pr;	// pageref for the new page
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *volatile fl;	// free list entry
 
-			spinlock_release(&kmalloc_spinlock);
-			return retptr;
-		}
-	}
+	volatile int i;
 
 	/*
-	 * No page of the right size available.
-	 * Make a new one.
-	 *
 	 * We release the spinlock while calling alloc_kpages. This
 	 * avoids deadlock if alloc_kpages needs to come back here.
 	 * Note that this means things can change behind our back...
@@ -963,12 +1362,20 @@ subpage_kmalloc(size_t sz
 
 	spinlock_release(&kmalloc_spinlock);
 	prpage = alloc_kpages(1);
+	if (prpage == 0) {
+		/* Blocks sitting in magazines may be holding pages. */
+		kmag_drainall();
+		prpage = alloc_kpages(1);
+	}
 	if (prpage==0) {
 		/* Out of memory. */
 		kprintf("kmalloc: Subpage allocator couldn't get a page\n");
-		return NULL;
+		spinlock_acquire(&kmalloc_spinlock);
+		return 1;
 	}
 	KASSERT(prpage % PAGE_SIZE == 0);
+	coremap_setkmtag(KVADDR_TO_PADDR(prpage), KMTAG_SUBPAGE(blktype),
+			 sizes[blktype]);
 #ifdef CHECKBEEF
 	/* deadbeef the whole page, as it probably starts zeroed */
 	fill_deadbeef((void *)prpage, PAGE_SIZE);
@@ -981,7 +1388,8 @@ subpage_kmalloc(size_t sz
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
 		kprintf("kmalloc: Subpage allocator couldn't get pageref\n");
-		return NULL;
+		spinlock_acquire(&kmalloc_spinlock);
+		return 1;
 	}
 
 	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
@@ -1011,104 +1419,68 @@ subpage_kmalloc(size_t sz
 	pr->next_all = allbase;
 	allbase = pr;
 
-	/* This is kind of cheesy, but avoids duplicating the alloc code. */
-	goto doalloc;
+	return 0;
 }
 
 /*
- * Free a pointer previously returned from subpage_kmalloc. If the
- * pointer is not on any heap page we recognize, return -1.
+ * Find the pageref for the heap page holding address PTRADDR, or
+ * NULL if it isn't on one of our pages. The caller must hold
+ * kmalloc_spinlock.
  */
 static
-int
-subpage_kfree(void *ptr)
+struct pageref *
+subpage_findpage(vaddr_t ptraddr)
 {
-	int blktype;		// index into sizes[] that we're using
-	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
-	vaddr_t offset;		// offset into page
-#ifdef GUARDS
-	size_t blocksize, smallerblocksize;
-#endif
-
-	ptraddr = (vaddr_t)ptr;
-#ifdef GUARDS
-	if (ptraddr % PAGE_SIZE == 0) {
-		/*
-		 * With guard bands, all client-facing subpage
-		 * pointers are offset by GUARD_PTROFFSET (which is 4)
-		 * from the underlying blocks and are therefore not
-		 * page-aligned. So a page-aligned pointer is not one
-		 * of ours. Catch this up front, as otherwise
-		 * subtracting GUARD_PTROFFSET could give a pointer on
-		 * a page we *do* own, and then we'll panic because
-		 * it's not a valid one.
-		 */
-		return -1;
-	}
-	ptraddr -= GUARD_PTROFFSET;
-#endif
-#ifdef LABELS
-	if (ptraddr % PAGE_SIZE == 0) {
-		/* ditto */
-		return -1;
-	}
-	ptraddr -= LABEL_PTROFFSET;
-#endif
-
-	spinlock_acquire(&kmalloc_spinlock);
+	int blktype;		// index into sizes[] that we're using
 
-	checksubpages();
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
 	for (pr = allbase; pr; pr = pr->next_all) {
 		prpage = PR_PAGEADDR(pr);
 		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
 
 		/* check for corruption */
 		KASSERT(blktype>=0 && blktype<NSIZES);
 		checksubpage(pr);
 
+		kmalloc_nsteps++;
 		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
 			break;
 		}
 	}
+	return pr;
+}
 
-	if (pr==NULL) {
-		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
-		return -1;
-	}
-
-	offset = ptraddr - prpage;
-
-	/* Check for proper positioning and alignment */
-	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
-		panic("kfree: subpage free of invalid addr %p\n", ptr);
-	}
+/*
+ * Put the free block at BLOCK back on PR's free list. If that makes
+ * the whole page free, remove it from the heap and return its
+ * address for the caller to free_kpages once it has dropped
+ * kmalloc_spinlock; otherwise return 0.
+ */
+static
+vaddr_t
+subpage_putblock(struct pageref *pr, vaddr_t block)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	struct freelist *fl;	// free list entry
+	vaddr_t offset;		// offset into page
 
-#ifdef GUARDS
-	blocksize = sizes[blktype];
-	smallerblocksize = blktype > 0 ? sizes[blktype - 1] : 0;
-	checkguardband(ptraddr, smallerblocksize, blocksize);
-#endif
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
-	/*
-	 * Clear the block to 0xdeadbeef to make it easier to detect
-	 * uses of dangling pointers.
-	 */
-	fill_deadbeef((void *)ptraddr, sizes[blktype]);
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	offset = block - prpage;
+	KASSERT(offset < PAGE_SIZE && offset % sizes[blktype] == 0);
 
 	/*
 	 * We probably ought to check for free twice by seeing if the block
 	 * is already on the free list. But that's expensive, so we don't.
 	 */
 
-	fla = prpage + offset;
-	fl = (struct freelist *)fla;
+	fl = (struct freelist *)block;
 	if (pr->freelist_offset == INVALID_OFFSET) {
 		fl->next = NULL;
 	} else {
@@ -1130,18 +1502,454 @@ subpage_kfree(void *ptr)
 	}
 	pr->freelist_offset = offset;
 	pr->nfree++;
+	kmalloc_nmoved++;
 
 	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
 	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
 		/* Whole page is free. */
 		remove_lists(pr, blktype);
 		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
+		return prpage;
+	}
+	return 0;
+}
+
+/*
+ * Put N free blocks back on their pages, and release any pages that
+ * become empty.
+ */
+static
+void
+subpage_putblocks(vaddr_t *blocks, unsigned n)
+{
+	vaddr_t freepages[KMAG_MAXBLOCKS];
+	struct pageref *pr;
+	unsigned i, nfreepages;
+
+	KASSERT(n <= KMAG_MAXBLOCKS);
+	nfreepages = 0;
+
+	spinlock_acquire(&kmalloc_spinlock);
+	kmalloc_nlocks++;
+	checksubpages();
+	for (i=0; i<n; i++) {
+		pr = subpage_findpage(blocks[i]);
+		KASSERT(pr != NULL);
+		freepages[nfreepages] = subpage_putblock(pr, blocks[i]);
+		if (freepages[nfreepages] != 0) {
+			nfreepages++;
+		}
+	}
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+
+	/* Call free_kpages without kmalloc_spinlock. */
+	for (i=0; i<nfreepages; i++) {
+		free_kpages(freepages[i]);
+	}
+}
+
+////////////////////////////////////////
+//
+// Per-CPU magazines.
+//
+//    Each CPU keeps, for each block size, a small stack (a "magazine")
+//    of free blocks. kmalloc pops a block off this CPU's magazine and
+//    kfree pushes one on, so most allocations and frees never take
+//    kmalloc_spinlock or walk the page lists. An empty magazine is
+//    refilled with half its capacity of blocks in one trip to the
+//    pages above, and a full one gives half back the same way.
+//    Capacities are set so a full magazine holds about a page.
+//
+//    Blocks in magazines count as allocated as far as their pages
+//    are concerned (and show up that way in kheap_dump), so a page
+//    isn't released until its blocks come back out of the magazines.
+//    If the allocator runs out of pages, it empties every magazine
+//    and tries again.
+//
+//    To push a block on the right magazine kfree needs to know its
+//    size without searching the page lists, so heap pages are tagged
+//    with their block type in the coremap. Pages that can't be
+//    tagged, because they were allocated before the coremap was set
+//    up, are freed to directly instead.
+//
+//    Each CPU's magazines have a spinlock, as with the coremap's
+//    per-CPU frame caches. Nobody else takes it except to empty the
+//    magazines, and a thread that changes CPUs while using them just
+//    ends up using the new CPU's, which is harmless. The lock is
+//    never held together with kmalloc_spinlock.
+//
+
+struct kmag {
+	vaddr_t km_blocks[KMAG_MAXBLOCKS];
+	unsigned km_num;		/* blocks in the magazine */
+};
+
+struct kmag_pcpu {
+	struct spinlock kc_lock;
+	struct kmag kc_mags[NSIZES];
+	unsigned kc_nalloc;		/* subpage kmallocs */
+	unsigned kc_nrefill;		/* ...that had to refill */
+	unsigned kc_nfree;		/* subpage kfrees */
+	unsigned kc_nflush;		/* ...that had to flush */
+};
+
+static struct kmag_pcpu kmag_pcpu[MAXCPUS];
+
+/*
+ * Magazine capacity for block type BLKTYPE.
+ */
+static
+unsigned
+kmag_capacity(unsigned blktype)
+{
+	unsigned n;
+
+	n = KMAG_BYTES / sizes[blktype];
+	return n < KMAG_MAXBLOCKS ? n : KMAG_MAXBLOCKS;
+}
+
+/*
+ * This CPU's magazine set, locked, or NULL early in boot before
+ * there is a curcpu.
+ */
+static
+struct kmag_pcpu *
+kmag_get(void)
+{
+	struct kmag_pcpu *kc;
+
+	if (!CURCPU_EXISTS()) {
+		return NULL;
+	}
+	kc = &kmag_pcpu[curcpu->c_number];
+	spinlock_acquire(&kc->kc_lock);
+	return kc;
+}
+
+/*
+ * Take a block of type BLKTYPE for kmalloc. If this CPU's magazine is
+ * empty, fill it halfway from the pages, making a new page if
+ * necessary. Returns 0 if out of memory.
+ */
+static
+vaddr_t
+kmag_alloc(unsigned blktype)
+{
+	vaddr_t blocks[KMAG_MAXBLOCKS];
+	struct kmag_pcpu *kc;
+	struct kmag *mag;
+	unsigned i, n, want;
+	vaddr_t block;
+
+	kc = kmag_get();
+	if (kc != NULL) {
+		kc->kc_nalloc++;
+		mag = &kc->kc_mags[blktype];
+		if (mag->km_num > 0) {
+			block = mag->km_blocks[--mag->km_num];
+			spinlock_release(&kc->kc_lock);
+			return block;
+		}
+		kc->kc_nrefill++;
+		spinlock_release(&kc->kc_lock);
+		want = kmag_capacity(blktype) / 2;
 	}
 	else {
-		spinlock_release(&kmalloc_spinlock);
+		want = 1;
+	}
+
+	n = 0;
+	spinlock_acquire(&kmalloc_spinlock);
+	kmalloc_nlocks++;
+	checksubpages();
+	while (n < want) {
+		block = subpage_getblock(blktype);
+		if (block != 0) {
+			blocks[n++] = block;
+		}
+		else if (n > 0 || subpage_newpage(blktype)) {
+			break;
+		}
+	}
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+
+	if (n == 0) {
+		return 0;
+	}
+
+	/* Keep one; the rest go in the magazine if it still has room. */
+	block = blocks[--n];
+	if (n > 0) {
+		kc = kmag_get();
+		KASSERT(kc != NULL);
+		mag = &kc->kc_mags[blktype];
+		for (i = n; i > 0 && mag->km_num < kmag_capacity(blktype); i--) {
+			mag->km_blocks[mag->km_num++] = blocks[i - 1];
+		}
+		spinlock_release(&kc->kc_lock);
+		if (i > 0) {
+			subpage_putblocks(blocks, i);
+		}
+	}
+	return block;
+}
+
+/*
+ * Take a free block of type BLKTYPE from kfree. If this CPU's
+ * magazine is full, give half of it back to the pages first.
+ */
+static
+void
+kmag_free(int blktype, vaddr_t block)
+{
+	vaddr_t blocks[KMAG_MAXBLOCKS];
+	struct kmag_pcpu *kc;
+	struct kmag *mag;
+	unsigned n;
+
+	kc = kmag_get();
+	if (kc == NULL) {
+		subpage_putblocks(&block, 1);
+		return;
+	}
+
+	n = 0;
+	kc->kc_nfree++;
+	mag = &kc->kc_mags[blktype];
+	if (mag->km_num == kmag_capacity(blktype)) {
+		kc->kc_nflush++;
+		while (mag->km_num > kmag_capacity(blktype) / 2) {
+			blocks[n++] = mag->km_blocks[--mag->km_num];
+		}
+	}
+	KASSERT(mag->km_num < kmag_capacity(blktype));
+	mag->km_blocks[mag->km_num++] = block;
+	spinlock_release(&kc->kc_lock);
+
+	if (n > 0) {
+		subpage_putblocks(blocks, n);
+	}
+}
+
+/*
+ * Empty every CPU's magazines, for when memory runs short.
+ */
+static
+void
+kmag_drainall(void)
+{
+	vaddr_t blocks[KMAG_MAXBLOCKS];
+	struct kmag_pcpu *kc;
+	struct kmag *mag;
+	unsigned i, j, n;
+
+	for (i=0; i<MAXCPUS; i++) {
+		kc = &kmag_pcpu[i];
+		for (j=0; j<NSIZES; j++) {
+			spinlock_acquire(&kc->kc_lock);
+			mag = &kc->kc_mags[j];
+			n = mag->km_num;
+			memcpy(blocks, mag->km_blocks, n * sizeof(vaddr_t));
+			mag->km_num = 0;
+			spinlock_release(&kc->kc_lock);
+
+			if (n > 0) {
+				subpage_putblocks(blocks, n);
+			}
+		}
+	}
+}
+
+/*
+ * Print the magazine hit rates, for kheap_printstats.
+ */
+static
+void
+kmag_printstats(void)
+{
+	struct kmag_pcpu *kc;
+	unsigned i, j, nblocks;
+	unsigned nalloc = 0, nrefill = 0, nfree = 0, nflush = 0;
+
+	kprintf("Per-CPU magazines:\n");
+	for (i=0; i<MAXCPUS; i++) {
+		kc = &kmag_pcpu[i];
+		spinlock_acquire(&kc->kc_lock);
+		if (kc->kc_nalloc == 0 && kc->kc_nfree == 0) {
+			spinlock_release(&kc->kc_lock);
+			continue;
+		}
+		nblocks = 0;
+		for (j=0; j<NSIZES; j++) {
+			nblocks += kc->kc_mags[j].km_num;
+		}
+		kprintf("   cpu%u: %u kmallocs, %u refills; %u kfrees, "
+			"%u flushes; %u blocks held\n", i,
+			kc->kc_nalloc, kc->kc_nrefill,
+			kc->kc_nfree, kc->kc_nflush, nblocks);
+		nalloc += kc->kc_nalloc;
+		nrefill += kc->kc_nrefill;
+		nfree += kc->kc_nfree;
+		nflush += kc->kc_nflush;
+		spinlock_release(&kc->kc_lock);
+	}
+	if (nalloc > 0) {
+		kprintf("   kmalloc hit rate %u%%\n",
+			(nalloc - nrefill) * 100 / nalloc);
+	}
+	if (nfree > 0) {
+		kprintf("   kfree hit rate %u%%\n",
+			(nfree - nflush) * 100 / nfree);
+	}
+}
+
+////////////////////////////////////////
+
+/*
+ * Allocate a block of size SZ, where SZ is not large enough to
+ * warrant a whole-page allocation.
+ */
+static
+void *
+subpage_kmalloc(size_t sz
+#ifdef LABELS
+		, vaddr_t label
+#endif
+	)
+{
+	unsigned blktype;	// index into sizes[] that we're using
+	void *retptr;		// our result
+
+#ifdef GUARDS
+	size_t clientsz;
+#endif
+
+#ifdef GUARDS
+	clientsz = sz;
+	sz += GUARD_OVERHEAD;
+#endif
+#ifdef LABELS
+#ifdef GUARDS
+	/* Include the label in what GUARDS considers the client data. */
+	clientsz += LABEL_PTROFFSET;
+#endif
+	sz += LABEL_PTROFFSET;
+#endif
+	blktype = blocktype(sz);
+	sz = sizes[blktype];
+
+	retptr = (void *)kmag_alloc(blktype);
+	if (retptr == NULL) {
+		return NULL;
+	}
+#ifdef GUARDS
+	retptr = establishguardband(retptr, clientsz, sz);
+#endif
+#ifdef LABELS
+	retptr = establishlabel(retptr, label);
+#endif
+	return retptr;
+}
+
+/*
+ * Free a pointer previously returned from subpage_kmalloc. If the
+ * pointer is not on any heap page we recognize, return -1.
+ */
+static
+int
+subpage_kfree(void *ptr)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t ptraddr;	// same as ptr
+	struct pageref *pr;	// pageref for page we're freeing in
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t offset;		// offset into page
+	unsigned tag;		// coremap tag for the page
+#ifdef GUARDS
+	size_t blocksize, smallerblocksize;
+#endif
+
+	ptraddr = (vaddr_t)ptr;
+#ifdef GUARDS
+	if (ptraddr % PAGE_SIZE == 0) {
+		/*
+		 * With guard bands, all client-facing subpage
+		 * pointers are offset by GUARD_PTROFFSET (which is 4)
+		 * from the underlying blocks and are therefore not
+		 * page-aligned. So a page-aligned pointer is not one
+		 * of ours. Catch this up front, as otherwise
+		 * subtracting GUARD_PTROFFSET could give a pointer on
+		 * a page we *do* own, and then we'll panic because
+		 * it's not a valid one.
+		 */
+		return -1;
+	}
+	ptraddr -= GUARD_PTROFFSET;
+#endif
+#ifdef LABELS
+	if (ptraddr % PAGE_SIZE == 0) {
+		/* ditto */
+		return -1;
+	}
+	ptraddr -= LABEL_PTROFFSET;
+#endif
+
+	prpage = ptraddr & PAGE_FRAME;
+	tag = coremap_getkmtag(KVADDR_TO_PADDR(prpage), NULL);
+	if (KMTAG_ISSUBPAGE(tag)) {
+		/* A tagged page; no need to search. */
+		pr = NULL;
+		blktype = tag - 1;
+	}
+	else if (tag != 0) {
+		/* One of the bigger kinds */
+		return -1;
+	}
+	else {
+		/* Untagged; it might still be one of ours. */
+		spinlock_acquire(&kmalloc_spinlock);
+		kmalloc_nlocks++;
+		pr = subpage_findpage(ptraddr);
+		if (pr == NULL) {
+			/* Not on any of our pages - not a subpage allocation */
+			spinlock_release(&kmalloc_spinlock);
+			return -1;
+		}
+		KASSERT(PR_PAGEADDR(pr) == prpage);
+		blktype = PR_BLOCKTYPE(pr);
+	}
+
+	offset = ptraddr - prpage;
+
+	/* Check for proper positioning and alignment */
+	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
+		panic("kfree: subpage free of invalid addr %p\n", ptr);
+	}
+
+#ifdef GUARDS
+	blocksize = sizes[blktype];
+	smallerblocksize = blktype > 0 ? sizes[blktype - 1] : 0;
+	checkguardband(ptraddr, smallerblocksize, blocksize);
+#endif
+
+	/*
+	 * Clear the block to 0xdeadbeef to make it easier to detect
+	 * uses of dangling pointers.
+	 */
+	fill_deadbeef((void *)ptraddr, sizes[blktype]);
+
+	if (pr == NULL) {
+		kmag_free(blktype, ptraddr);
+		return 0;
+	}
+
+	prpage = subpage_putblock(pr, ptraddr);
+	spinlock_release(&kmalloc_spinlock);
+	if (prpage != 0) {
+		/* Call free_kpages without kmalloc_spinlock. */
+		free_kpages(prpage);
 	}
 
 #ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
@@ -1153,6 +1961,249 @@ subpage_kfree(void *ptr)
 	return 0;
 }
 
+////////////////////////////////////////////////////////////
+//
+// Bigger allocations.
+//
+//    Blocks too big for the subpage allocator come in two more
+//    sizes. Up to 3K, they are carved four at a time out of runs of
+//    three pages, which wastes a quarter as much as giving each one a
+//    page of its own. Anything bigger gets whole pages from
+//    alloc_kpages, one page (the 4K class) coming from the coremap's
+//    per-CPU frame caches. Either way the pages are tagged in the
+//    coremap, a large allocation's first page with its requested
+//    size, so kfree can find what it's freeing at once, and the
+//    memory goes straight back to the coremap when it's freed. (An
+//    emptied 3K run is kept if it's the only one with room.)
+//
+//    Until the coremap is set up its pages can't be tagged, and
+//    they're never freed anyway, so during early boot everything
+//    over 2K just gets whole pages, untagged and unaccounted.
+//
+//    The 3K runs are on a list of their own, protected by
+//    kmalloc_spinlock. The descriptors come from the subpage
+//    allocator.
+//
+
+struct big3k_run {
+	struct big3k_run *br_next;
+	vaddr_t br_base;		/* address of first page */
+	unsigned br_inuse;		/* bit per allocated block */
+};
+
+static struct big3k_run *big3k_runs;
+
+/* Accounting, under kmalloc_spinlock. */
+static unsigned big3k_nruns;		/* runs now */
+static unsigned big3k_ninuse;		/* blocks allocated now */
+static unsigned big3k_nalloc;		/* allocations ever */
+static unsigned large_ninuse;		/* large allocations now */
+static unsigned large_npages;		/* ...pages they use */
+static size_t large_nbytes;		/* ...bytes asked for */
+static unsigned large_nalloc;		/* allocations ever */
+
+#define BIG3K_FULL	((1U << BIG3K_NBLOCKS) - 1)
+
+/*
+ * Allocate a block of between 2K and 3K.
+ */
+static
+void *
+big3k_kmalloc(void)
+{
+	struct big3k_run *br, *newbr;
+	vaddr_t base;
+	unsigned i;
+
+	newbr = NULL;
+	spinlock_acquire(&kmalloc_spinlock);
+	while (1) {
+		for (br = big3k_runs; br != NULL; br = br->br_next) {
+			if (br->br_inuse != BIG3K_FULL) {
+				break;
+			}
+		}
+		if (br != NULL) {
+			break;
+		}
+		if (newbr != NULL) {
+			newbr->br_next = big3k_runs;
+			big3k_runs = newbr;
+			big3k_nruns++;
+			br = newbr;
+			newbr = NULL;
+			break;
+		}
+
+		/* Make a new run, without the lock, and look again. */
+		spinlock_release(&kmalloc_spinlock);
+		newbr = kmalloc(sizeof(*newbr));
+		if (newbr == NULL) {
+			return NULL;
+		}
+		base = alloc_kpages(BIG3K_NPAGES);
+		if (base == 0) {
+			kfree(newbr);
+			return NULL;
+		}
+		for (i=0; i<BIG3K_NPAGES; i++) {
+			coremap_setkmtag(KVADDR_TO_PADDR(base + i*PAGE_SIZE),
+					 KMTAG_BIG3K, BIG3K_SIZE);
+		}
+		newbr->br_base = base;
+		newbr->br_inuse = 0;
+		spinlock_acquire(&kmalloc_spinlock);
+	}
+
+	for (i=0; i<BIG3K_NBLOCKS; i++) {
+		if ((br->br_inuse & (1U << i)) == 0) {
+			break;
+		}
+	}
+	KASSERT(i < BIG3K_NBLOCKS);
+	br->br_inuse |= 1U << i;
+	big3k_ninuse++;
+	big3k_nalloc++;
+	spinlock_release(&kmalloc_spinlock);
+
+	if (newbr != NULL) {
+		/* Somebody else made room first. */
+		free_kpages(newbr->br_base);
+		kfree(newbr);
+	}
+
+	return (void *)(br->br_base + i * BIG3K_SIZE);
+}
+
+/*
+ * Free a 3K block. If that empties its run and another run has room,
+ * release it.
+ */
+static
+void
+big3k_kfree(void *ptr)
+{
+	struct big3k_run *br, **brp, *other;
+	vaddr_t ptraddr = (vaddr_t)ptr;
+	vaddr_t offset;
+	unsigned bit;
+
+	spinlock_acquire(&kmalloc_spinlock);
+	for (brp = &big3k_runs; *brp != NULL; brp = &(*brp)->br_next) {
+		br = *brp;
+		if (ptraddr >= br->br_base &&
+		    ptraddr < br->br_base + BIG3K_NPAGES * PAGE_SIZE) {
+			break;
+		}
+	}
+	br = *brp;
+	if (br == NULL) {
+		panic("kfree: 3K block %p not in any run\n", ptr);
+	}
+
+	offset = ptraddr - br->br_base;
+	bit = 1U << (offset / BIG3K_SIZE);
+	if (offset % BIG3K_SIZE != 0 || (br->br_inuse & bit) == 0) {
+		panic("kfree: invalid free of 3K block %p\n", ptr);
+	}
+	fill_deadbeef(ptr, BIG3K_SIZE);
+	br->br_inuse &= ~bit;
+	big3k_ninuse--;
+
+	if (br->br_inuse != 0) {
+		spinlock_release(&kmalloc_spinlock);
+		return;
+	}
+	for (other = big3k_runs; other != NULL; other = other->br_next) {
+		if (other != br && other->br_inuse != BIG3K_FULL) {
+			break;
+		}
+	}
+	if (other == NULL) {
+		/* Keep it for next time. */
+		spinlock_release(&kmalloc_spinlock);
+		return;
+	}
+	*brp = br->br_next;
+	big3k_nruns--;
+	spinlock_release(&kmalloc_spinlock);
+
+	free_kpages(br->br_base);
+	kfree(br);
+}
+
+/*
+ * Allocate SZ bytes of whole pages.
+ */
+static
+void *
+large_kmalloc(size_t sz)
+{
+	unsigned long npages;
+	vaddr_t address;
+
+	/* Round up to a whole number of pages. */
+	npages = DIVROUNDUP(sz, PAGE_SIZE);
+	address = alloc_kpages(npages);
+	if (address==0) {
+		return NULL;
+	}
+	KASSERT(address % PAGE_SIZE == 0);
+	if (!coremap_isready()) {
+		/* Boot memory: untagged, and never really freed */
+		return (void *)address;
+	}
+	coremap_setkmtag(KVADDR_TO_PADDR(address), KMTAG_LARGE, sz);
+
+	spinlock_acquire(&kmalloc_spinlock);
+	large_ninuse++;
+	large_npages += npages;
+	large_nbytes += sz;
+	large_nalloc++;
+	spinlock_release(&kmalloc_spinlock);
+
+	return (void *)address;
+}
+
+/*
+ * Free a large allocation of SZ bytes.
+ */
+static
+void
+large_kfree(void *ptr, size_t sz)
+{
+	KASSERT((vaddr_t)ptr % PAGE_SIZE == 0);
+
+	spinlock_acquire(&kmalloc_spinlock);
+	KASSERT(large_ninuse > 0);
+	large_ninuse--;
+	large_npages -= DIVROUNDUP(sz, PAGE_SIZE);
+	large_nbytes -= sz;
+	spinlock_release(&kmalloc_spinlock);
+
+	free_kpages((vaddr_t)ptr);
+}
+
+/*
+ * Print the accounting for the above, for kheap_printstats. Called
+ * with kmalloc_spinlock held.
+ */
+static
+void
+big_printstats(void)
+{
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	kprintf("3K blocks: %u in use in %u runs (%u pages), "
+		"%u allocations\n", big3k_ninuse, big3k_nruns,
+		big3k_nruns * BIG3K_NPAGES, big3k_nalloc);
+	kprintf("Large allocations: %u in use, %u pages for %lu bytes "
+		"(%lu wasted), %u allocations\n", large_ninuse, large_npages,
+		(unsigned long)large_nbytes,
+		(unsigned long)(large_npages * PAGE_SIZE - large_nbytes),
+		large_nalloc);
+}
+
 //
 ////////////////////////////////////////////////////////////
 
@@ -1164,39 +2215,41 @@ void *
 kmalloc(size_t sz)
 {
 	size_t checksz;
-#ifdef LABELS
 	vaddr_t label;
-#endif
+	void *ret;
 
-#ifdef LABELS
 #ifdef __GNUC__
 	label = (vaddr_t)__builtin_return_address(0);
 #else
 #error "Don't know how to get return address with this compiler"
 #endif /* __GNUC__ */
-#endif /* LABELS */
 
 	checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD;
-	if (checksz >= LARGEST_SUBPAGE_SIZE) {
-		unsigned long npages;
-		vaddr_t address;
-
-		/* Round up to a whole number of pages. */
-		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
-		address = alloc_kpages(npages);
-		if (address==0) {
-			return NULL;
+	if (checksz > LARGEST_SUBPAGE_SIZE) {
+		/*
+		 * No guard bands or labels on these. 3K runs need
+		 * their pages tagged, which can't be done until the
+		 * coremap is up.
+		 */
+		if (sz <= BIG3K_SIZE && coremap_isready()) {
+			ret = big3k_kmalloc();
+		}
+		else {
+			ret = large_kmalloc(sz);
 		}
-		KASSERT(address % PAGE_SIZE == 0);
-
-		return (void *)address;
 	}
-
+	else {
 #ifdef LABELS
-	return subpage_kmalloc(sz, label);
+		ret = subpage_kmalloc(sz, label);
 #else
-	return subpage_kmalloc(sz);
+		ret = subpage_kmalloc(sz);
 #endif
+	}
+
+	if (khprof_on && ret != NULL) {
+		khprof_alloc((vaddr_t)ret, sz, label);
+	}
+	return ret;
 }
 
 /*
@@ -1205,14 +2258,35 @@ kmalloc(size_t sz)
 void
 kfree(void *ptr)
 {
+	unsigned tag;
+	size_t sz;
+
 	/*
-	 * Try subpage first; if that fails, assume it's a big allocation.
+	 * Try subpage first; if that fails, it's one of the bigger
+	 * kinds. The coremap tag says which, unless it's from before
+	 * the coremap was set up, in which case it's just pages: no
+	 * 3K runs are made until then (see kmalloc).
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
-		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
-		free_kpages((vaddr_t)ptr);
+	}
+	if (khprof_on) {
+		khprof_free((vaddr_t)ptr);
+	}
+	if (subpage_kfree(ptr)) {
+		tag = coremap_getkmtag(KVADDR_TO_PADDR((vaddr_t)ptr & PAGE_FRAME),
+				       &sz);
+		if (tag == KMTAG_BIG3K) {
+			big3k_kfree(ptr);
+		}
+		else if (tag == KMTAG_LARGE) {
+			large_kfree(ptr, sz);
+		}
+		else {
+			KASSERT(tag == 0);
+			KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
+			free_kpages((vaddr_t)ptr);
+		}
 	}
 }
 
@@ -0,0 +1,465 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Object caches.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <kmemcache.h>
+
+/*
+ * Each slab is one page, with a header at the start followed by one
+ * link byte per object and then the objects themselves. A free
+ * object's link byte holds the index of the next free object on the
+ * same list, or KS_NONE, so free objects are left untouched and keep
+ * their constructed state.
+ *
+ * A slab's free objects are on one of two lists: those that have
+ * been constructed, and those that never have been (or whose
+ * constructor failed). Allocation takes a constructed one if it can;
+ * constructing objects only as they're first needed means a slab of
+ * small objects doesn't build a lock for every one of them up front.
+ *
+ * The slabs with free objects are on the cache's kc_partial list.
+ * Full slabs aren't on any list; their objects find them again by
+ * rounding down to the page. When a slab is entirely free it's kept
+ * in kc_empty if that's vacant and otherwise destroyed, so a cache
+ * doesn't hold on to more than one unused page.
+ *
+ * Each cache has a spinlock. Constructors and destructors are called
+ * without it, so they may use kmalloc and other caches freely.
+ */
+
+#define KS_NONE		0xff
+#define KS_MAXOBJS	KS_NONE
+#define KMEM_ALIGN	8
+
+struct kmem_slab {
+	struct kmem_cache *ks_cache;
+	struct kmem_slab *ks_next;	/* on kc_partial */
+	struct kmem_slab *ks_prev;
+	unsigned ks_nfree;		/* free objects, on either list */
+	unsigned ks_freehead;		/* first constructed free object */
+	unsigned ks_rawhead;		/* first unconstructed free object */
+};
+
+#define KS_LINKS(ks)	((uint8_t *)((ks) + 1))
+
+struct kmem_cache {
+	char *kc_name;
+	size_t kc_size;			/* object size, aligned */
+	unsigned kc_perslab;		/* objects per slab */
+	size_t kc_objoffset;		/* offset of first object in a slab */
+	int (*kc_ctor)(void *obj);
+	void (*kc_dtor)(void *obj);
+
+	struct spinlock kc_lock;
+	struct kmem_slab *kc_partial;	/* slabs with free objects */
+	struct kmem_slab *kc_empty;	/* one spare wholly free slab */
+
+	/* statistics */
+	unsigned kc_nslabs;		/* slabs now */
+	unsigned kc_ninuse;		/* objects allocated now */
+	unsigned kc_nalloc;		/* kmem_cache_alloc calls */
+	unsigned kc_nctor;		/* constructor calls */
+	unsigned kc_ndtor;		/* destructor calls */
+	unsigned kc_nslaballoc;		/* slabs made */
+
+	struct kmem_cache *kc_next;	/* on kmem_caches */
+};
+
+/* All caches, for kmem_cache_printstats. */
+static struct kmem_cache *kmem_caches;
+static struct spinlock kmem_caches_lock = SPINLOCK_INITIALIZER;
+
+////////////////////////////////////////////////////////////
+// Slabs
+
+static
+void *
+kmem_slab_obj(struct kmem_cache *kc, struct kmem_slab *ks, unsigned ix)
+{
+	KASSERT(ix < kc->kc_perslab);
+	return (char *)ks + kc->kc_objoffset + ix * kc->kc_size;
+}
+
+static
+unsigned
+kmem_slab_index(struct kmem_cache *kc, struct kmem_slab *ks, void *obj)
+{
+	size_t offset;
+
+	offset = (char *)obj - (char *)ks - kc->kc_objoffset;
+	KASSERT(offset % kc->kc_size == 0);
+	KASSERT(offset / kc->kc_size < kc->kc_perslab);
+	return offset / kc->kc_size;
+}
+
+/*
+ * Get a new slab, with every object free and unconstructed.
+ */
+static
+struct kmem_slab *
+kmem_slab_create(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	uint8_t *links;
+	unsigned i;
+
+	ks = (struct kmem_slab *)alloc_kpages(1);
+	if (ks == NULL) {
+		return NULL;
+	}
+	ks->ks_cache = kc;
+	ks->ks_next = ks->ks_prev = NULL;
+	ks->ks_nfree = kc->kc_perslab;
+	ks->ks_freehead = KS_NONE;
+	ks->ks_rawhead = 0;
+	links = KS_LINKS(ks);
+	for (i=0; i<kc->kc_perslab; i++) {
+		links[i] = i + 1 < kc->kc_perslab ? i + 1 : KS_NONE;
+	}
+	return ks;
+}
+
+/*
+ * Run the destructor on each constructed object of a wholly free
+ * slab, and release its page. Cache lock not held.
+ */
+static
+void
+kmem_slab_destroy(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+	uint8_t *links;
+	unsigned ix, n;
+
+	KASSERT(ks->ks_nfree == kc->kc_perslab);
+
+	links = KS_LINKS(ks);
+	n = 0;
+	for (ix = ks->ks_freehead; ix != KS_NONE; ix = links[ix]) {
+		if (kc->kc_dtor != NULL) {
+			kc->kc_dtor(kmem_slab_obj(kc, ks, ix));
+		}
+		n++;
+	}
+	free_kpages((vaddr_t)ks);
+
+	spinlock_acquire(&kc->kc_lock);
+	kc->kc_ndtor += n;
+	spinlock_release(&kc->kc_lock);
+}
+
+/*
+ * Put KS on / take it off the partial list. Cache lock held.
+ */
+static
+void
+kmem_slab_link(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+	ks->ks_prev = NULL;
+	ks->ks_next = kc->kc_partial;
+	if (kc->kc_partial != NULL) {
+		kc->kc_partial->ks_prev = ks;
+	}
+	kc->kc_partial = ks;
+}
+
+static
+void
+kmem_slab_unlink(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+	if (ks->ks_prev != NULL) {
+		ks->ks_prev->ks_next = ks->ks_next;
+	}
+	else {
+		KASSERT(kc->kc_partial == ks);
+		kc->kc_partial = ks->ks_next;
+	}
+	if (ks->ks_next != NULL) {
+		ks->ks_next->ks_prev = ks->ks_prev;
+	}
+	ks->ks_next = ks->ks_prev = NULL;
+}
+
+/*
+ * Return object IX to KS, on the constructed list if CONSTRUCTED and
+ * the unconstructed list otherwise. If that leaves KS wholly free
+ * and there's already a spare slab, return KS for the caller to
+ * destroy once it has dropped the lock; otherwise NULL.
+ */
+static
+struct kmem_slab *
+kmem_slab_put(struct kmem_cache *kc, struct kmem_slab *ks, unsigned ix,
+	      bool constructed)
+{
+	uint8_t *links;
+
+	KASSERT(spinlock_do_i_hold(&kc->kc_lock));
+	KASSERT(ks->ks_nfree < kc->kc_perslab);
+
+	links = KS_LINKS(ks);
+	if (constructed) {
+		links[ix] = ks->ks_freehead;
+		ks->ks_freehead = ix;
+	}
+	else {
+		links[ix] = ks->ks_rawhead;
+		ks->ks_rawhead = ix;
+	}
+	ks->ks_nfree++;
+	KASSERT(kc->kc_ninuse > 0);
+	kc->kc_ninuse--;
+
+	if (ks->ks_nfree == 1) {
+		kmem_slab_link(kc, ks);
+	}
+	if (ks->ks_nfree == kc->kc_perslab) {
+		kmem_slab_unlink(kc, ks);
+		if (kc->kc_empty == NULL) {
+			kc->kc_empty = ks;
+			return NULL;
+		}
+		kc->kc_nslabs--;
+		return ks;
+	}
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////
+// Caches
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc;
+	unsigned n;
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	kc->kc_name = kstrdup(name);
+	if (kc->kc_name == NULL) {
+		kfree(kc);
+		return NULL;
+	}
+
+	kc->kc_size = ROUNDUP(size, KMEM_ALIGN);
+
+	/*
+	 * Fit as many objects as we can, with a link byte each, after
+	 * the header.
+	 */
+	n = (PAGE_SIZE - sizeof(struct kmem_slab)) / (kc->kc_size + 1);
+	if (n > KS_MAXOBJS) {
+		n = KS_MAXOBJS;
+	}
+	while (n > 0 && ROUNDUP(sizeof(struct kmem_slab) + n, KMEM_ALIGN)
+	       + n * kc->kc_size > PAGE_SIZE) {
+		n--;
+	}
+	KASSERT(n > 0);
+	kc->kc_perslab = n;
+	kc->kc_objoffset = ROUNDUP(sizeof(struct kmem_slab) + n, KMEM_ALIGN);
+
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+	spinlock_init(&kc->kc_lock);
+	kc->kc_partial = NULL;
+	kc->kc_empty = NULL;
+	kc->kc_nslabs = 0;
+	kc->kc_ninuse = 0;
+	kc->kc_nalloc = 0;
+	kc->kc_nctor = 0;
+	kc->kc_ndtor = 0;
+	kc->kc_nslaballoc = 0;
+
+	spinlock_acquire(&kmem_caches_lock);
+	kc->kc_next = kmem_caches;
+	kmem_caches = kc;
+	spinlock_release(&kmem_caches_lock);
+
+	return kc;
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_cache **p;
+	struct kmem_slab *ks;
+
+	KASSERT(kc->kc_ninuse == 0);
+
+	spinlock_acquire(&kmem_caches_lock);
+	for (p = &kmem_caches; *p != kc; p = &(*p)->kc_next) {
+		KASSERT(*p != NULL);
+	}
+	*p = kc->kc_next;
+	spinlock_release(&kmem_caches_lock);
+
+	/* With nothing in use, every slab is wholly free. */
+	while ((ks = kc->kc_partial) != NULL) {
+		kmem_slab_unlink(kc, ks);
+		kmem_slab_destroy(kc, ks);
+	}
+	if (kc->kc_empty != NULL) {
+		kmem_slab_destroy(kc, kc->kc_empty);
+	}
+
+	spinlock_cleanup(&kc->kc_lock);
+	kfree(kc->kc_name);
+	kfree(kc);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks, *newks, *freeks;
+	uint8_t *links;
+	unsigned ix;
+	bool constructed;
+	void *obj;
+	int result;
+
+	newks = NULL;
+	spinlock_acquire(&kc->kc_lock);
+	while (kc->kc_partial == NULL) {
+		if (kc->kc_empty != NULL) {
+			kmem_slab_link(kc, kc->kc_empty);
+			kc->kc_empty = NULL;
+			break;
+		}
+		if (newks != NULL) {
+			kmem_slab_link(kc, newks);
+			kc->kc_nslabs++;
+			kc->kc_nslaballoc++;
+			newks = NULL;
+			break;
+		}
+
+		/* Get a page without the lock, then look again. */
+		spinlock_release(&kc->kc_lock);
+		newks = kmem_slab_create(kc);
+		if (newks == NULL) {
+			return NULL;
+		}
+		spinlock_acquire(&kc->kc_lock);
+	}
+
+	ks = kc->kc_partial;
+	links = KS_LINKS(ks);
+	if (ks->ks_freehead != KS_NONE) {
+		ix = ks->ks_freehead;
+		ks->ks_freehead = links[ix];
+		constructed = true;
+	}
+	else {
+		ix = ks->ks_rawhead;
+		KASSERT(ix != KS_NONE);
+		ks->ks_rawhead = links[ix];
+		constructed = false;
+		if (kc->kc_ctor != NULL) {
+			kc->kc_nctor++;
+		}
+	}
+	KASSERT(ks->ks_nfree > 0);
+	ks->ks_nfree--;
+	if (ks->ks_nfree == 0) {
+		kmem_slab_unlink(kc, ks);
+	}
+	kc->kc_ninuse++;
+	kc->kc_nalloc++;
+	spinlock_release(&kc->kc_lock);
+
+	if (newks != NULL) {
+		/* Somebody else came up with a slab first. */
+		kmem_slab_destroy(kc, newks);
+	}
+
+	obj = kmem_slab_obj(kc, ks, ix);
+	if (!constructed && kc->kc_ctor != NULL) {
+		result = kc->kc_ctor(obj);
+		if (result) {
+			spinlock_acquire(&kc->kc_lock);
+			freeks = kmem_slab_put(kc, ks, ix, false);
+			spinlock_release(&kc->kc_lock);
+			if (freeks != NULL) {
+				kmem_slab_destroy(kc, freeks);
+			}
+			return NULL;
+		}
+	}
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_slab *ks, *freeks;
+	unsigned ix;
+
+	KASSERT(obj != NULL);
+	ks = (struct kmem_slab *)((vaddr_t)obj & PAGE_FRAME);
+	KASSERT(ks->ks_cache == kc);
+	ix = kmem_slab_index(kc, ks, obj);
+
+	spinlock_acquire(&kc->kc_lock);
+	freeks = kmem_slab_put(kc, ks, ix, true);
+	spinlock_release(&kc->kc_lock);
+
+	if (freeks != NULL) {
+		kmem_slab_destroy(kc, freeks);
+	}
+}
+
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_cache *kc;
+
+	kprintf("%-12s %5s %4s %6s %6s %8s %6s %6s\n", "cache", "size",
+		"slab", "slabs", "inuse", "allocs", "ctors", "dtors");
+
+	spinlock_acquire(&kmem_caches_lock);
+	for (kc = kmem_caches; kc != NULL; kc = kc->kc_next) {
+		spinlock_acquire(&kc->kc_lock);
+		kprintf("%-12s %5u %4u %6u %6u %8u %6u %6u\n",
+			kc->kc_name, (unsigned)kc->kc_size, kc->kc_perslab,
+			kc->kc_nslabs, kc->kc_ninuse, kc->kc_nalloc,
+			kc->kc_nctor, kc->kc_ndtor);
+		spinlock_release(&kc->kc_lock);
+	}
+	spinlock_release(&kmem_caches_lock);
+}
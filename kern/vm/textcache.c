@@ -0,0 +1,319 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Cache of shared program text pages.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <synch.h>
+#include <vnode.h>
+#include <elf.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <vmstat.h>
+#include <textcache.h>
+
+/*
+ * One cached page: the frame holding LEN bytes of V from OFFSET,
+ * PAGEOFF bytes into the page, with zeros around them. Pages are
+ * hashed by vnode and offset.
+ */
+struct textpage {
+	struct vnode *tp_vnode;
+	off_t tp_offset;
+	size_t tp_pageoff;
+	size_t tp_len;
+	paddr_t tp_paddr;
+	struct textpage *tp_next;
+};
+
+#define TEXTCACHE_NBUCKETS	64
+
+static struct textpage *textcache_buckets[TEXTCACHE_NBUCKETS];
+static unsigned textcache_npages;
+
+/*
+ * Each vnode some address space is running as text, with the number
+ * of text regions backed by it. These can't be written; see
+ * textcache.h.
+ */
+struct textuser {
+	struct vnode *tu_vnode;
+	unsigned tu_count;
+	struct textuser *tu_next;
+};
+
+static struct textuser *textcache_users;
+
+/* Protects the above. Held while taking and dropping references. */
+static struct lock *textcache_lock;
+
+void
+textcache_bootstrap(void)
+{
+	textcache_lock = lock_create("textcache");
+	if (textcache_lock == NULL) {
+		panic("textcache: lock_create failed\n");
+	}
+}
+
+static
+unsigned
+textcache_hash(struct vnode *v, off_t offset)
+{
+	return ((uintptr_t)v / sizeof(void *) + offset / PAGE_SIZE) %
+		TEXTCACHE_NBUCKETS;
+}
+
+/*
+ * Find the cached page with the given contents. Call with the lock
+ * held.
+ */
+static
+struct textpage *
+textcache_find(struct vnode *v, off_t offset, size_t pageoff, size_t len)
+{
+	struct textpage *tp;
+
+	KASSERT(lock_do_i_hold(textcache_lock));
+
+	tp = textcache_buckets[textcache_hash(v, offset)];
+	for (; tp != NULL; tp = tp->tp_next) {
+		if (tp->tp_vnode == v && tp->tp_offset == offset &&
+		    tp->tp_pageoff == pageoff && tp->tp_len == len) {
+			return tp;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * If the page is cached, add a reference to its frame and hand it
+ * back. Call with the lock held.
+ */
+static
+bool
+textcache_share(struct vnode *v, off_t offset, size_t pageoff, size_t len,
+		paddr_t *ret)
+{
+	struct textpage *tp;
+
+	tp = textcache_find(v, offset, pageoff, len);
+	if (tp == NULL) {
+		return false;
+	}
+	coremap_incref(tp->tp_paddr);
+	*ret = tp->tp_paddr;
+	return true;
+}
+
+bool
+textcache_istext(struct region *rg)
+{
+	return rg->rg_vnode != NULL && rg->rg_mmap == 0 &&
+		(rg->rg_perms & PF_W) == 0;
+}
+
+int
+textcache_get(struct addrspace *as, struct region *rg, vaddr_t vaddr,
+	      paddr_t *ret)
+{
+	struct textpage *tp;
+	struct vnode *v;
+	off_t offset;
+	size_t pageoff, len;
+	unsigned b;
+	paddr_t paddr;
+	int result;
+
+	KASSERT(textcache_istext(rg));
+
+	if (!as_filedata(rg, vaddr, &offset, &pageoff, &len)) {
+		return ENOENT;
+	}
+	v = rg->rg_vnode;
+
+	lock_acquire(textcache_lock);
+	if (textcache_share(v, offset, pageoff, len, ret)) {
+		lock_release(textcache_lock);
+		vmstat_inc(VS_TEXTSHARES);
+		return 0;
+	}
+	lock_release(textcache_lock);
+
+	/* Not there; read it in, without holding up everyone else. */
+	tp = kmalloc(sizeof(*tp));
+	if (tp == NULL) {
+		return ENOMEM;
+	}
+	paddr = coremap_alloc_zupage(as, vaddr);
+	if (paddr == 0) {
+		kfree(tp);
+		return ENOMEM;
+	}
+	vmstat_inc(VS_FILEINS);
+	result = as_fill_page(rg, vaddr, paddr);
+	if (result) {
+		coremap_free_upage(paddr, as);
+		kfree(tp);
+		return result;
+	}
+
+	lock_acquire(textcache_lock);
+	if (textcache_share(v, offset, pageoff, len, ret)) {
+		/* Someone else read it in meanwhile; use theirs. */
+		lock_release(textcache_lock);
+		coremap_free_upage(paddr, as);
+		kfree(tp);
+		vmstat_inc(VS_TEXTSHARES);
+		return 0;
+	}
+
+	VOP_INCREF(v);
+	tp->tp_vnode = v;
+	tp->tp_offset = offset;
+	tp->tp_pageoff = pageoff;
+	tp->tp_len = len;
+	tp->tp_paddr = paddr;
+	b = textcache_hash(v, offset);
+	tp->tp_next = textcache_buckets[b];
+	textcache_buckets[b] = tp;
+	textcache_npages++;
+
+	/* One reference for AS, one for the cache. */
+	coremap_incref(paddr);
+	lock_release(textcache_lock);
+
+	coremap_unpin(paddr);
+	*ret = paddr;
+	return 0;
+}
+
+/*
+ * Find the textuser entry for V. Call with the lock held.
+ */
+static
+struct textuser **
+textcache_finduser(struct vnode *v)
+{
+	struct textuser **tup;
+
+	KASSERT(lock_do_i_hold(textcache_lock));
+
+	for (tup = &textcache_users; *tup != NULL; tup = &(*tup)->tu_next) {
+		if ((*tup)->tu_vnode == v) {
+			break;
+		}
+	}
+	return tup;
+}
+
+int
+textcache_attach(struct vnode *v)
+{
+	struct textuser *tu;
+
+	lock_acquire(textcache_lock);
+	tu = *textcache_finduser(v);
+	if (tu == NULL) {
+		tu = kmalloc(sizeof(*tu));
+		if (tu == NULL) {
+			lock_release(textcache_lock);
+			return ENOMEM;
+		}
+		tu->tu_vnode = v;
+		tu->tu_count = 0;
+		tu->tu_next = textcache_users;
+		textcache_users = tu;
+	}
+	tu->tu_count++;
+	lock_release(textcache_lock);
+	return 0;
+}
+
+bool
+textcache_busy(struct vnode *v)
+{
+	bool ret;
+
+	lock_acquire(textcache_lock);
+	ret = *textcache_finduser(v) != NULL;
+	lock_release(textcache_lock);
+	return ret;
+}
+
+void
+textcache_detach(struct vnode *v)
+{
+	struct textpage *tp, **prev;
+	struct textuser **tup, *tu;
+	unsigned i;
+
+	lock_acquire(textcache_lock);
+
+	tup = textcache_finduser(v);
+	tu = *tup;
+	KASSERT(tu != NULL && tu->tu_count > 0);
+	tu->tu_count--;
+	if (tu->tu_count == 0) {
+		*tup = tu->tu_next;
+		kfree(tu);
+	}
+
+	/* Drop the pages no address space maps any more. */
+	for (i = 0; i < TEXTCACHE_NBUCKETS; i++) {
+		prev = &textcache_buckets[i];
+		while (*prev != NULL) {
+			tp = *prev;
+			if (tp->tp_vnode != v ||
+			    coremap_refcount(tp->tp_paddr) > 1) {
+				prev = &tp->tp_next;
+				continue;
+			}
+			/* Only we have it now. */
+			*prev = tp->tp_next;
+			coremap_free(tp->tp_paddr);
+			VOP_DECREF(tp->tp_vnode);
+			kfree(tp);
+			textcache_npages--;
+		}
+	}
+	lock_release(textcache_lock);
+}
+
+void
+textcache_printstats(void)
+{
+	kprintf("text cache: %u pages\n", textcache_npages);
+}
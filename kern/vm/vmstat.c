@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * VM event counters.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <vmstat.h>
+
+static unsigned vmstat_counts[MAXCPUS][VS_NCOUNTERS];
+
+static const char *const vmstat_names[VS_NCOUNTERS] = VMSTAT_NAMES;
+
+void
+vmstat_inc(unsigned which)
+{
+	vmstat_add(which, 1);
+}
+
+void
+vmstat_add(unsigned which, unsigned n)
+{
+	int spl;
+
+	KASSERT(which < VS_NCOUNTERS);
+
+	/* Stay on this CPU while we're at it. */
+	spl = splhigh();
+	vmstat_counts[curcpu->c_number][which] += n;
+	splx(spl);
+}
+
+void
+vmstat_getcpu(unsigned cpu, unsigned counts[VS_NCOUNTERS])
+{
+	unsigned i;
+
+	KASSERT(cpu < MAXCPUS);
+	for (i = 0; i < VS_NCOUNTERS; i++) {
+		counts[i] = vmstat_counts[cpu][i];
+	}
+}
+
+void
+vmstat_gettotals(unsigned counts[VS_NCOUNTERS])
+{
+	unsigned cpu, i;
+
+	for (i = 0; i < VS_NCOUNTERS; i++) {
+		counts[i] = 0;
+	}
+	for (cpu = 0; cpu < MAXCPUS; cpu++) {
+		for (i = 0; i < VS_NCOUNTERS; i++) {
+			counts[i] += vmstat_counts[cpu][i];
+		}
+	}
+}
+
+void
+vmstat_print(void)
+{
+	unsigned counts[VS_NCOUNTERS];
+	unsigned i;
+
+	vmstat_gettotals(counts);
+	for (i = 0; i < VS_NCOUNTERS; i++) {
+		kprintf("%10u %s\n", counts[i], vmstat_names[i]);
+	}
+}
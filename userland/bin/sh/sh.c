@@ -355,6 +355,24 @@ static struct {
 	{ NULL, NULL }
 };
 
+/*
+ * vfork_child_error
+ * reports a failed exec of PROG from a vforked child. the child is
+ * sharing our memory, so this uses write() directly, not stdio.
+ */
+static
+void
+vfork_child_error(const char *prog)
+{
+	const char *msg;
+
+	msg = strerror(errno);
+	write(STDERR_FILENO, prog, strlen(prog));
+	write(STDERR_FILENO, ": ", 2);
+	write(STDERR_FILENO, msg, strlen(msg));
+	write(STDERR_FILENO, "\n", 1);
+}
+
 /*
  * docommand
  * tokenizes the command line using strtok.  if there aren't any commands,
@@ -421,17 +439,27 @@ docommand(char *buf, struct exitinfo *ei)
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
+	/*
+	 * The child does nothing but exec the command, so it can
+	 * borrow our memory instead of copying it.
+	 */
+	pid = vfork();
 	switch (pid) {
 		case -1:
 			/* error */
-			warn("fork");
+			warn("vfork");
 			exitinfo_exit(ei, 255);
 			return;
 		case 0:
 			/* child */
 			execvp(args[0], args);
-			warn("%s", args[0]);
+			/*
+			 * We're still running in our parent's memory,
+			 * so don't touch stdio (e.g. with warn()); it
+			 * would use the parent's buffers. Report with
+			 * plain write() instead.
+			 */
+			vfork_child_error(args[0]);
 			/*
 			 * Use _exit() instead of exit() in the child
 			 * process to avoid calling atexit() functions,
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <kern/vmstat.h>
+
+/*
+ * vmstat - print VM event counters.
+ * Usage: vmstat [prog [args...]]
+ *
+ * With no arguments, prints the system-wide counters since boot. With
+ * a program, runs it and prints how much each counter changed while
+ * it ran. The counters aren't per-process, so anything else running
+ * at the same time shows up too.
+ */
+
+static const char *const names[VS_NCOUNTERS] = VMSTAT_NAMES;
+
+static
+void
+getcounts(unsigned *counts)
+{
+	if (__vmstat(counts, VS_NCOUNTERS) < 0) {
+		err(1, "__vmstat");
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned before[VS_NCOUNTERS], after[VS_NCOUNTERS];
+	const char *msg;
+	unsigned i;
+	pid_t pid;
+	int status;
+
+	if (argc == 1) {
+		for (i=0; i<VS_NCOUNTERS; i++) {
+			before[i] = 0;
+		}
+	}
+	else {
+		getcounts(before);
+		pid = vfork();
+		if (pid < 0) {
+			err(1, "vfork");
+		}
+		if (pid == 0) {
+			/* Our memory is the parent's; no stdio here. */
+			execv(argv[1], argv+1);
+			msg = strerror(errno);
+			write(STDERR_FILENO, argv[1], strlen(argv[1]));
+			write(STDERR_FILENO, ": ", 2);
+			write(STDERR_FILENO, msg, strlen(msg));
+			write(STDERR_FILENO, "\n", 1);
+			_exit(1);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+	}
+
+	getcounts(after);
+	for (i=0; i<VS_NCOUNTERS; i++) {
+		printf("%10u %s\n", after[i] - before[i], names[i]);
+	}
+	return 0;
+}
@@ -113,6 +113,13 @@ __DEAD void _exit(int code);
 int execv(const char *prog, char *const *args);
 pid_t fork(void);
 pid_t waitpid(pid_t pid, int *returncode, int flags);
+/*
+ * Like fork, but the child shares the parent's memory, and the parent
+ * doesn't run again until the child has called execv or _exit. The
+ * child must do nothing else but that (in particular, not return from
+ * the function that called vfork).
+ */
+pid_t vfork(void);
 /*
  * Open actually takes either two or three args: the optional third
  * arg is the file mode used for creation. Unless you're implementing
@@ -148,6 +155,7 @@ int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
 ssize_t __getcwd(char *buf, size_t buflen);
+int __vmstat(unsigned *counts, unsigned ncounts);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -74,7 +74,8 @@ system(const char *cmd)
 
 	argv[nargs] = NULL;
 
-	pid = fork();
+	/* The child only execs, so it needn't copy our memory. */
+	pid = vfork();
 	switch (pid) {
 	    case -1:
 		return -1;
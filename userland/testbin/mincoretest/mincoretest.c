@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * mincoretest - test mincore() and madvise().
+ *
+ * Uses a stretch of bss, which the VM system fills in only when
+ * touched, and checks what mincore reports:
+ *    - before anything is touched, no page is resident;
+ *    - after touching every other page, exactly those are;
+ *    - after MADV_DONTNEED, none are, and they read back as zeros;
+ *    - after MADV_WILLNEED, all are.
+ * Also checks that mincore rejects a misaligned address.
+ *
+ * This assumes nothing else is pushing our pages out to swap while it
+ * runs.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+/*
+ * Caution: OS/161 doesn't provide any way to get this properly from
+ * the kernel. The page size is 4K on almost all hardware... but not
+ * all. If porting to certain weird machines this will need attention.
+ */
+#define PAGE_SIZE 4096
+
+#define NPAGES 16
+
+/* One spare page, so the part we use can be page-aligned */
+static char space[(NPAGES + 1) * PAGE_SIZE];
+static char vec[NPAGES];
+
+/*
+ * Get the residency of our pages and compare with what's expected:
+ * WANT(i) is true for each page I that should be resident.
+ */
+static
+void
+check(const char *when, char *pages, int (*want)(unsigned))
+{
+	unsigned i;
+
+	if (mincore(pages, NPAGES * PAGE_SIZE, vec) < 0) {
+		err(1, "mincore");
+	}
+	for (i=0; i<NPAGES; i++) {
+		if (!!(vec[i] & MINCORE_INCORE) != !!want(i)) {
+			errx(1, "%s: page %u %s resident", when, i,
+			     want(i) ? "not" : "unexpectedly");
+		}
+	}
+	printf("mincoretest: %s: ok\n", when);
+}
+
+static
+int
+none(unsigned pg)
+{
+	(void)pg;
+	return 0;
+}
+
+static
+int
+evens(unsigned pg)
+{
+	return pg % 2 == 0;
+}
+
+static
+int
+all(unsigned pg)
+{
+	(void)pg;
+	return 1;
+}
+
+int
+main(void)
+{
+	char *pages;
+	unsigned i, j;
+
+	pages = (char *)(((uintptr_t)space + PAGE_SIZE - 1) &
+			 ~(uintptr_t)(PAGE_SIZE - 1));
+
+	check("untouched", pages, none);
+
+	for (i=0; i<NPAGES; i+=2) {
+		pages[i * PAGE_SIZE] = 'x';
+	}
+	check("every other page touched", pages, evens);
+
+	if (madvise(pages, NPAGES * PAGE_SIZE, MADV_DONTNEED) < 0) {
+		err(1, "madvise(MADV_DONTNEED)");
+	}
+	check("after MADV_DONTNEED", pages, none);
+
+	if (madvise(pages, NPAGES * PAGE_SIZE, MADV_WILLNEED) < 0) {
+		err(1, "madvise(MADV_WILLNEED)");
+	}
+	check("after MADV_WILLNEED", pages, all);
+
+	for (i=0; i<NPAGES; i++) {
+		for (j=0; j<PAGE_SIZE; j++) {
+			if (pages[i * PAGE_SIZE + j] != 0) {
+				errx(1, "page %u byte %u not zero after "
+				     "MADV_DONTNEED", i, j);
+			}
+		}
+	}
+	printf("mincoretest: pages zero after MADV_DONTNEED: ok\n");
+
+	if (mincore(pages + 1, PAGE_SIZE, vec) == 0) {
+		errx(1, "mincore on a misaligned address succeeded");
+	}
+	if (errno != EINVAL) {
+		err(1, "mincore on a misaligned address: wrong error");
+	}
+
+	printf("mincoretest: passed\n");
+	return 0;
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * mmaptest - test mmap() and munmap() on a file.
+ *
+ * Makes a file a few pages long, then checks that:
+ *    - a MAP_SHARED mapping shows what's in the file;
+ *    - stores through it reach the file after fsync() (which also
+ *      flushes shared mappings; there's no msync), and after munmap();
+ *    - a MAP_PRIVATE mapping at a nonzero offset shows the right part
+ *      of the file, and stores through it don't reach the file.
+ *
+ * The file is checked with plain read() each time.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+/*
+ * Caution: OS/161 doesn't provide any way to get this properly from
+ * the kernel. The page size is 4K on almost all hardware... but not
+ * all. If porting to certain weird machines this will need attention.
+ */
+#define PAGE_SIZE 4096
+
+#define NPAGES 4
+#define FILENAME "mmaptest.tmp"
+
+static unsigned char pagebuf[PAGE_SIZE];
+
+/*
+ * The byte expected at offset I of page PG for generation GEN.
+ */
+static
+unsigned char
+pattern(unsigned pg, unsigned i, unsigned gen)
+{
+	return (pg * 61 + i * 7 + gen * 13) & 0xff;
+}
+
+static
+void
+fillpage(unsigned char *p, unsigned pg, unsigned gen)
+{
+	unsigned i;
+
+	for (i=0; i<PAGE_SIZE; i++) {
+		p[i] = pattern(pg, i, gen);
+	}
+}
+
+static
+void
+checkpage(const unsigned char *p, unsigned pg, unsigned gen,
+	  const char *what)
+{
+	unsigned i;
+
+	for (i=0; i<PAGE_SIZE; i++) {
+		if (p[i] != pattern(pg, i, gen)) {
+			errx(1, "%s: page %u byte %u is %u, should be %u",
+			     what, pg, i, p[i], pattern(pg, i, gen));
+		}
+	}
+}
+
+/*
+ * Read page PG of the file with read() and check it.
+ */
+static
+void
+checkfile(int fd, unsigned pg, unsigned gen, const char *what)
+{
+	int r;
+
+	if (lseek(fd, pg * PAGE_SIZE, SEEK_SET) < 0) {
+		err(1, "%s: lseek", FILENAME);
+	}
+	r = read(fd, pagebuf, PAGE_SIZE);
+	if (r < 0) {
+		err(1, "%s: read", FILENAME);
+	}
+	if (r != PAGE_SIZE) {
+		errx(1, "%s: short read", FILENAME);
+	}
+	checkpage(pagebuf, pg, gen, what);
+}
+
+static
+unsigned char *
+domap(size_t len, int prot, int flags, int fd, off_t offset)
+{
+	void *p;
+
+	p = mmap(NULL, len, prot, flags, fd, offset);
+	if (p == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	return p;
+}
+
+static
+void
+dounmap(void *p, size_t len)
+{
+	if (munmap(p, len) < 0) {
+		err(1, "munmap");
+	}
+}
+
+int
+main(void)
+{
+	unsigned char *p;
+	unsigned pg;
+	int fd, r;
+
+	fd = open(FILENAME, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	for (pg=0; pg<NPAGES; pg++) {
+		fillpage(pagebuf, pg, 0);
+		r = write(fd, pagebuf, PAGE_SIZE);
+		if (r < 0) {
+			err(1, "%s: write", FILENAME);
+		}
+		if (r != PAGE_SIZE) {
+			errx(1, "%s: short write", FILENAME);
+		}
+	}
+
+	printf("Reading through a shared mapping...\n");
+	p = domap(NPAGES * PAGE_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	for (pg=0; pg<NPAGES; pg++) {
+		checkpage(p + pg * PAGE_SIZE, pg, 0, "shared mapping");
+	}
+
+	printf("Writing through it and syncing...\n");
+	for (pg=0; pg<NPAGES; pg++) {
+		fillpage(p + pg * PAGE_SIZE, pg, 1);
+	}
+	if (fsync(fd) < 0) {
+		err(1, "%s: fsync", FILENAME);
+	}
+	for (pg=0; pg<NPAGES; pg++) {
+		checkfile(fd, pg, 1, "file after fsync");
+	}
+
+	printf("Writing through it and unmapping...\n");
+	for (pg=0; pg<NPAGES; pg++) {
+		fillpage(p + pg * PAGE_SIZE, pg, 2);
+	}
+	dounmap(p, NPAGES * PAGE_SIZE);
+	for (pg=0; pg<NPAGES; pg++) {
+		checkfile(fd, pg, 2, "file after munmap");
+	}
+
+	printf("Writing through a private mapping...\n");
+	p = domap((NPAGES - 1) * PAGE_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE,
+		  fd, PAGE_SIZE);
+	for (pg=1; pg<NPAGES; pg++) {
+		checkpage(p + (pg - 1) * PAGE_SIZE, pg, 2, "private mapping");
+		fillpage(p + (pg - 1) * PAGE_SIZE, pg, 3);
+	}
+	for (pg=1; pg<NPAGES; pg++) {
+		checkpage(p + (pg - 1) * PAGE_SIZE, pg, 3,
+			  "private mapping after writing");
+	}
+	dounmap(p, (NPAGES - 1) * PAGE_SIZE);
+	for (pg=0; pg<NPAGES; pg++) {
+		checkfile(fd, pg, 2, "file after private writes");
+	}
+
+	close(fd);
+	if (remove(FILENAME) < 0) {
+		err(1, "%s: remove", FILENAME);
+	}
+
+	printf("mmaptest: passed\n");
+	return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * vforktest - test vfork().
+ *
+ * After vfork the child borrows the parent's memory, and the parent
+ * must not run again until the child has called execv or _exit. The
+ * child here leaves a trail in a shared variable, taking its time
+ * about it, and the parent checks the whole trail is there as soon as
+ * it resumes. This is tried with a child that exits, one that execs
+ * /bin/true, and one whose execv fails and that has to _exit after.
+ *
+ * The child uses nothing but write(), execv() and _exit(): anything
+ * using stdio would be working on the parent's buffers.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+#define EXIT_PLAIN	7	/* exit code of the child that just exits */
+#define EXIT_NOEXEC	9	/* exit code after a failed execv */
+
+/* Written by the child, read by the parent */
+static volatile int trail;
+static volatile int childerr;
+
+/*
+ * Give a broken vfork a chance to run the parent too early.
+ */
+static
+void
+dawdle(void)
+{
+	int i;
+
+	for (i=0; i<200; i++) {
+		(void)getpid();
+	}
+}
+
+static
+void
+childsay(const char *msg)
+{
+	write(STDERR_FILENO, msg, strlen(msg));
+}
+
+/*
+ * Run a child that execs PROG, or just exits if PROG is NULL, and
+ * check what the parent sees afterwards.
+ */
+static
+void
+dotest(const char *desc, const char *prog, int wanttrail, int wanterr,
+       int wantstatus)
+{
+	char *args[2];
+	pid_t pid;
+	int status;
+
+	printf("vforktest: %s\n", desc);
+
+	args[0] = (char *)prog;
+	args[1] = NULL;
+	trail = 0;
+	childerr = 0;
+
+	pid = vfork();
+	if (pid < 0) {
+		err(1, "vfork");
+	}
+	if (pid == 0) {
+		/* child */
+		trail = 1;
+		dawdle();
+		trail = 2;
+		if (prog == NULL) {
+			_exit(EXIT_PLAIN);
+		}
+		execv(prog, args);
+		childerr = errno;
+		trail = 3;
+		childsay("vforktest: child: execv failed, exiting\n");
+		_exit(EXIT_NOEXEC);
+	}
+
+	/* parent: the child must be done with our memory by now */
+	if (trail != wanttrail) {
+		errx(1, "%s: parent resumed at step %d of the child, "
+		     "should be %d", desc, trail, wanttrail);
+	}
+	if (childerr != wanterr) {
+		errx(1, "%s: child saw error %d, should be %d",
+		     desc, childerr, wanterr);
+	}
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "%s: waitpid", desc);
+	}
+	if (!WIFEXITED(status)) {
+		errx(1, "%s: child did not exit normally", desc);
+	}
+	if (WEXITSTATUS(status) != wantstatus) {
+		errx(1, "%s: child exit %d, should be %d",
+		     desc, WEXITSTATUS(status), wantstatus);
+	}
+}
+
+int
+main(void)
+{
+	dotest("child calls _exit", NULL, 2, 0, EXIT_PLAIN);
+	dotest("child execs /bin/true", "/bin/true", 2, 0, 0);
+	dotest("child execs a missing program", "/vforktest/nonexistent",
+	       3, ENOENT, EXIT_NOEXEC);
+
+	printf("vforktest: passed\n");
+	return 0;
+}